@@ -4,7 +4,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include <SDL2/SDL.h>
 #include <GL/gl.h>
 #include <GL/glext.h>
@@ -13,36 +27,231 @@
 #include FT_FREETYPE_H
 #include "SDL_console.h"
 
+/*
+ * One shader draws everything. Solid quads (background, cursor) just use
+ * their vertex color while text quads take their alpha from the texture.
+ */
 static const GLchar* _Console_vertex_source =
     "#version 130\n"
     "in vec4 vertex; // <vec2 pos, vec2 tex>\n"
+    "in vec4 color;\n"
+    "in float mode;\n"
     "out vec2 TexCoords;\n"
+    "out vec4 Color;\n"
+    "flat out float Mode;\n"
     "uniform mat4 projection;\n"
     "void main()\n"
     "{\n"
     "   gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);\n"
     "   TexCoords = vertex.zw;\n"
+    "   Color = color;\n"
+    "   Mode = mode;\n"
     "}";
 static const GLchar* _Console_frag_source =
     "#version 130\n"
     "in vec2 TexCoords;\n"
+    "in vec4 Color;\n"
+    "flat in float Mode;\n"
     "out vec4 outColor;\n"
     "uniform sampler2D text;\n"
-    "uniform vec3 textColor;\n"
     "void main()\n"
     "{\n"
-    "   vec4 sampled = vec4(1.0, 1.0, 1.0, texture2D(text, TexCoords).r);\n"
-    "   outColor = vec4(textColor, 1.0) * sampled;\n"
+    "   float alpha = 1.0;\n"
+    "   if (Mode > 0.5)\n"
+    "       alpha = texture(text, TexCoords).r;\n"
+    "   outColor = vec4(Color.rgb, Color.a * alpha);\n"
+    "}";
+
+/*
+ * The grid renderer draws the whole console with one triangle covering the
+ * window. Each fragment looks up its cell in a buffer texture holding the
+ * atlas slot of its glyph and then fetches the glyph's pixel from the atlas.
+ * Cells are 4 bytes: the slot's low and high bytes and the foreground and
+ * background colors, where 0 is the default color and anything else indexes
+ * the palette from 1. Rows are counted from the bottom of the window.
+ */
+static const GLchar* _Console_grid_vertex_source =
+    "#version 140\n"
+    "void main()\n"
+    "{\n"
+    "   gl_Position = vec4(float(gl_VertexID == 1) * 4.0 - 1.0,\n"
+    "                      float(gl_VertexID == 2) * 4.0 - 1.0, 0.0, 1.0);\n"
     "}";
+/*
+ * With `sdf' set the atlas holds signed distance fields rendered at a
+ * reference size and cells can be any size on screen: the field is sampled
+ * with filtering and its edge at 0.5 is smoothed over about a pixel.
+ */
+static const GLchar* _Console_grid_frag_source =
+    "#version 140\n"
+    "out vec4 outColor;\n"
+    "uniform usamplerBuffer cells;\n"
+    "uniform sampler2D atlas;\n"
+    "uniform ivec2 grid;       // columns, rows\n"
+    "uniform vec2 cell_size;   // on screen, in pixels\n"
+    "uniform ivec2 atlas_cell; // in the atlas, in pixels\n"
+    "uniform int atlas_cols;\n"
+    "uniform bool sdf;\n"
+    "uniform float smoothing;  // half a pixel in distance field units\n"
+    "uniform ivec2 cursor;     // column, row\n"
+    "uniform vec4 bg_color;\n"
+    "uniform vec4 fg_color;\n"
+    "uniform vec4 cursor_color;\n"
+    "uniform vec4 palette[16];\n"
+    "vec4 over(vec4 src, vec4 dst)\n"
+    "{\n"
+    "   float a = src.a + dst.a * (1.0 - src.a);\n"
+    "   if (a <= 0.0)\n"
+    "       return vec4(0.0);\n"
+    "   return vec4((src.rgb * src.a + dst.rgb * dst.a * (1.0 - src.a)) / a, a);\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "   vec2 p = gl_FragCoord.xy;\n"
+    "   ivec2 c = ivec2(p / cell_size);\n"
+    "   vec4 color = bg_color;\n"
+    "   if (c.x < grid.x && c.y < grid.y) {\n"
+    "       uvec4 cell = texelFetch(cells, c.y * grid.x + c.x);\n"
+    "       int slot = int(cell.r | (cell.g << 8u));\n"
+    "       vec4 fg = cell.b == 0u ? fg_color : palette[cell.b - 1u];\n"
+    "       if (cell.a != 0u)\n"
+    "           color = over(palette[cell.a - 1u], color);\n"
+    "       vec2 f = p - vec2(c) * cell_size;\n"
+    "       ivec2 o = ivec2(slot % atlas_cols, slot / atlas_cols) * atlas_cell;\n"
+    "       float alpha;\n"
+    "       if (sdf) {\n"
+    "           vec2 t = f * vec2(atlas_cell) / cell_size;\n"
+    "           t = clamp(vec2(t.x, float(atlas_cell.y) - t.y),\n"
+    "                     vec2(0.5), vec2(atlas_cell) - 0.5);\n"
+    "           float d = texture(atlas,\n"
+    "                   (vec2(o) + t) / vec2(textureSize(atlas, 0))).r;\n"
+    "           alpha = smoothstep(0.5 - smoothing, 0.5 + smoothing, d);\n"
+    "       } else {\n"
+    "           ivec2 t = o + ivec2(int(f.x), atlas_cell.y - 1 - int(f.y));\n"
+    "           alpha = texelFetch(atlas, t, 0).r;\n"
+    "       }\n"
+    "       color = over(vec4(fg.rgb, fg.a * alpha), color);\n"
+    "       if (c == cursor)\n"
+    "           color = over(cursor_color, color);\n"
+    "   }\n"
+    "   outColor = color;\n"
+    "}";
+
+/*
+ * The atlas starts with room for 256 glyphs and doubles its rows when full,
+ * up to the 65536 slots a cell can address. Slot 0 is always blank.
+ */
+#define CONSOLE_ATLAS_COLS   16
+#define CONSOLE_ATLAS_ROWS   16
+#define CONSOLE_ATLAS_MAX    65536
+#define CONSOLE_CELL_BYTES   4
+
+/*
+ * Distance field glyphs are rendered once at this size and scaled from there.
+ * The spread is FreeType's default: distances of up to 8 pixels either side
+ * of an edge map to 0-255 with the edge at 128.
+ */
+#define CONSOLE_SDF_SIZE     48
+#define CONSOLE_SDF_SPREAD   8
+#if FREETYPE_MAJOR > 2 || (FREETYPE_MAJOR == 2 && FREETYPE_MINOR >= 11)
+#define CONSOLE_HAVE_SDF     1
+#endif
+
+#define _Console_m_uses_grid(tty) ((tty)->render_mode != CONSOLE_RENDER_LINES)
+
+/* Buckets of the table of interned outputs */
+#define CONSOLE_INTERN_BUCKETS 256
+
+/*
+ * Frame times kept for the perf command, and the size of the frame graph in
+ * the top right corner, one pixel wide bar per frame.
+ */
+#define CONSOLE_FRAME_TIMES    1024
+#define CONSOLE_GRAPH_BARS     240
+#define CONSOLE_GRAPH_HEIGHT   60
+#define CONSOLE_GRAPH_MARGIN   8
+#define CONSOLE_GRAPH_TARGET   (1000.0f / 60.0f)
+
+/*
+ * Counters for Console_GetStats. Building with CONSOLE_NO_STATS defined
+ * compiles them out and the stats read as zero.
+ */
+#ifndef CONSOLE_NO_STATS
+#define CONSOLE_STAT_ADD(tty, counter, n) ((tty)->stats.counter += (n))
+#define CONSOLE_STAT_NOW() SDL_GetPerformanceCounter()
+#define CONSOLE_STAT_SINCE(tty, counter, start) \
+    ((tty)->stats.counter += SDL_GetPerformanceCounter() - (start))
+#else
+#define CONSOLE_STAT_ADD(tty, counter, n) ((void)0)
+#define CONSOLE_STAT_NOW() 0
+#define CONSOLE_STAT_SINCE(tty, counter, start) ((void)(start))
+#endif
+
+/*
+ * Line textures given up by lines are kept for lines of the same size, up to
+ * this many.
+ */
+#define CONSOLE_POOL_MAX     32
+
+/*
+ * Glyphs are cached by codepoint in pages of 256 so that looking up a glyph
+ * is two array indexes. Pages are only allocated once a glyph in them is used.
+ */
+#define CONSOLE_GLYPH_PAGE_BITS  8
+#define CONSOLE_GLYPH_PAGE_SIZE  (1 << CONSOLE_GLYPH_PAGE_BITS)
+#define CONSOLE_GLYPH_PAGES      (0x110000 >> CONSOLE_GLYPH_PAGE_BITS)
+#define CONSOLE_REPLACEMENT_CHAR 0xFFFD
+
+/*
+ * The 16 colors of SGR escape codes 30-37 and 90-97 (and the backgrounds
+ * 40-47, 100-107). These are xterm's defaults.
+ */
+static const Console_Color _Console_palette[16] = {
+    { 0.000f, 0.000f, 0.000f, 1.0f },
+    { 0.804f, 0.000f, 0.000f, 1.0f },
+    { 0.000f, 0.804f, 0.000f, 1.0f },
+    { 0.804f, 0.804f, 0.000f, 1.0f },
+    { 0.000f, 0.000f, 0.933f, 1.0f },
+    { 0.804f, 0.000f, 0.804f, 1.0f },
+    { 0.000f, 0.804f, 0.804f, 1.0f },
+    { 0.898f, 0.898f, 0.898f, 1.0f },
+    { 0.498f, 0.498f, 0.498f, 1.0f },
+    { 1.000f, 0.000f, 0.000f, 1.0f },
+    { 0.000f, 1.000f, 0.000f, 1.0f },
+    { 1.000f, 1.000f, 0.000f, 1.0f },
+    { 0.361f, 0.361f, 1.000f, 1.0f },
+    { 1.000f, 0.000f, 1.000f, 1.0f },
+    { 0.000f, 1.000f, 1.000f, 1.0f },
+    { 1.000f, 1.000f, 1.000f, 1.0f },
+};
+
+/* Ctrl +/- zoom steps in pixels */
+#define CONSOLE_ZOOM_STEP     2
+#define CONSOLE_MIN_FONT_SIZE 6
 
 #define DEFAULT_PROMPT       "> "
 #define DEFAULT_PROMPT_LEN   2
 #define DEFAULT_LINE_LENGTH  128
 #define DEFAULT_LINE_CHARS   256
+
+/* Shown before the filter while searching, the same length as the prompt */
+#define CONSOLE_FILTER_PROMPT "/ "
+
+/* Matches of the filter are black on bright yellow */
+#define CONSOLE_MATCH_ATTR   ((Console_Attr) { 1, 12, false })
 #define CONSOLE_CHARS_LEN    128
 
 static char _Console_errstr[1024] = {0};
 
+/*
+ * Directory of the cache files, NULL if they're not used. It's only read
+ * through _Console_copy_cache_path since fonts load on other threads.
+ */
+static char *_Console_cache_path = NULL;
+static SDL_SpinLock _Console_cache_lock = 0;
+/* bumped whenever a cache file's layout changes */
+#define CONSOLE_CACHE_VERSION 1
+
 #define Console_SetError(cs,es) \
     strcpy(_Console_errstr, cs); \
     strcat(_Console_errstr, es);
@@ -65,29 +274,438 @@ FT_GetError (FT_Error err)
 
 }
 
+/* A rendered glyph as copied out of FreeType */
+typedef struct _Console_Glyph {
+    unsigned char *bitmap; /* NULL for glyphs without any pixels */
+    int width;
+    int rows;
+    int top;               /* rows from the baseline up to the bitmap's top */
+    int left;              /* columns the bitmap starts left of its cell */
+    int slot;              /* slot in the grid's atlas, 0 if not placed */
+    bool loaded;
+    bool mapped;           /* the bitmap is in the font's cache file */
+} Console_Glyph;
+
+typedef struct _Console_GlyphPage {
+    Console_Glyph glyphs[CONSOLE_GLYPH_PAGE_SIZE];
+} Console_GlyphPage;
+
+/*
+ * A font at one pixel size along with the glyphs rendered with it. Every font
+ * has a FreeType library of its own so it can be loaded on another thread.
+ */
 typedef struct _Console_Font {
+    char *path;
+    bool sdf;              /* glyphs are distance fields */
     FT_Library ft;
     FT_Face face;
+    Console_GlyphPage *pages[CONSOLE_GLYPH_PAGES];
     GLint font_size;
     GLint char_width;
     GLfloat advance;
     GLfloat line_height;
     GLfloat baseline;
+    /* glyphs loaded, and how many of them are in the cache file */
+    int num_glyphs;
+    int cached_glyphs;
+    /* glyphs rendered by FreeType, for the stats, read from other threads */
+    SDL_atomic_t rendered;
+    /* directory of the cache file, NULL if it isn't used */
+    char *cache_path;
+    /* key of the font file, the cache file is only used if it's set */
+    Uint64 hash;
+    bool hashed;
+    /* the cache file mapped into memory */
+    void *map;
+    size_t map_len;
+    /* next font in the console's cache */
+    struct _Console_Font *next;
 } Console_Font;
 
+/* A font being loaded on a thread of its own */
+typedef struct _Console_FontLoad {
+    char *path;
+    int size;
+    bool sdf;
+    Console_Font *font;  /* the result, NULL on failure */
+    char error[256];
+    SDL_atomic_t done;
+    SDL_Thread *thread;
+} Console_FontLoad;
+
+/*
+ * The pieces of GL state the console changes while drawing. They are ordered
+ * so that restoring them in reverse puts the 2D texture binding back before
+ * the active texture unit it belongs to. The buffer texture binding is always
+ * on the second texture unit.
+ */
+enum Console_GL_State {
+    CONSOLE_GL_PROGRAM,
+    CONSOLE_GL_VERTEX_ARRAY,
+    CONSOLE_GL_ARRAY_BUFFER,
+    CONSOLE_GL_ACTIVE_TEXTURE,
+    CONSOLE_GL_TEXTURE_2D,
+    CONSOLE_GL_TEXTURE_BUFFER,
+    CONSOLE_GL_UNPACK_ALIGNMENT,
+    CONSOLE_GL_BLEND,
+    CONSOLE_GL_BLEND_FUNC,
+    CONSOLE_GL_CULL_FACE,
+    CONSOLE_GL_STATE_MAX
+};
+
+/*
+ * The states the console has always left as-is instead of resetting them to
+ * GL's defaults. They are only restored if the user asks for it.
+ */
+#define CONSOLE_GL_KEEP_MASK ((1 << CONSOLE_GL_ACTIVE_TEXTURE) | \
+                              (1 << CONSOLE_GL_UNPACK_ALIGNMENT) | \
+                              (1 << CONSOLE_GL_BLEND_FUNC))
+
+/*
+ * Tracks GL state so that redundant calls are skipped and only what was
+ * changed between _Console_gl_begin and _Console_gl_end gets put back. What
+ * GL holds is remembered across frames until the program says it changed.
+ */
+typedef struct _Console_GLState {
+    int depth;          /* nesting of begin/end pairs */
+    unsigned touched;   /* bitmask of states changed since the first begin */
+    unsigned known;     /* bitmask of states whose value `current' holds */
+    bool restore;       /* restore the queried state instead of defaults */
+    GLint current[CONSOLE_GL_STATE_MAX];
+    GLint saved[CONSOLE_GL_STATE_MAX];
+    /* blend func is saved separately as src/dst pairs for rgb and alpha */
+    GLint saved_blend[4];
+} Console_GLState;
+
+/* How the fragment shader colors a quad */
+enum Console_Quad_Mode { 
+    CONSOLE_QUAD_SOLID, /* vertex color only */
+    CONSOLE_QUAD_TEXT   /* vertex color with alpha from the bound texture */
+};
+
+typedef struct _Console_Vertex {
+    GLfloat x, y;       /* position */
+    GLfloat s, t;       /* texture coordinates */
+    GLfloat r, g, b, a; /* color */
+    GLfloat mode;       /* Console_Quad_Mode */
+} Console_Vertex;
+
+/* A range of the batch's vertices drawn with one texture bound */
+typedef struct _Console_DrawCall {
+    GLuint texture;
+    int first;
+    int count;
+} Console_DrawCall;
+
+/*
+ * All the quads of a frame are collected here and uploaded at once. Solid
+ * quads don't sample and so are merged into whichever draw is current.
+ */
+typedef struct _Console_Batch {
+    Console_Vertex *vertices;
+    int num_vertices;
+    int max_vertices;
+    Console_DrawCall *draws;
+    int num_draws;
+    int max_draws;
+    /* size of the VBO's data store in bytes */
+    GLsizeiptr vbo_size;
+} Console_Batch;
+
+typedef struct _Console_Grid {
+    GLuint VAO;
+    GLuint program;
+    GLuint vert_shader;
+    GLuint frag_shader;
+    GLuint atlas;
+    GLuint cells_buffer;
+    GLuint cells_texture;
+    GLint grid_loc;
+    GLint cell_size_loc;
+    GLint atlas_cell_loc;
+    GLint sdf_loc;
+    GLint smoothing_loc;
+    GLint cursor_loc;
+    GLint bg_color_loc;
+    GLint fg_color_loc;
+    GLint cursor_color_loc;
+    /* rows of cells in the atlas texture */
+    int atlas_rows;
+    /* the glyph in each slot of the atlas, slot 0 is blank */
+    Console_Glyph **slots;
+    int num_slots;
+    int max_slots;
+    int cols;
+    int rows;
+    /* CPU copy of the cells, uploaded to cells_buffer */
+    unsigned char *cells;
+    /* rows taken up by the line being edited at the last build */
+    int head_rows;
+    /* the whole grid has to be laid out again */
+    bool rebuild;
+} Console_Grid;
+
+/*
+ * Colors of a character set by escape codes. 0 is the console's color and
+ * 1-16 index _Console_palette from 1.
+ */
+typedef struct _Console_Attr {
+    unsigned char fg;
+    unsigned char bg;
+    bool bold;
+} Console_Attr;
+
+/* A run of characters on one row of a line that aren't in default colors */
+typedef struct _Console_Span {
+    int row;
+    int col;
+    int len;
+    Console_Attr attr;
+} Console_Span;
+
+/*
+ * An output shared by every line that printed it. Lines point at `text'.
+ */
+typedef struct _Console_Interned {
+    struct _Console_Interned *next;
+    Uint64 hash;
+    int refs;
+    size_t len;
+    char text[];
+} Console_Interned;
+
+/*
+ * The output of an input function. Input functions are given a pointer to
+ * `text', which Console_SetOutputView turns back into the whole struct.
+ */
+typedef struct _Console_Output {
+    char *text;
+    const char *view;
+    size_t len;
+    Console_ReleaseFunction release;
+    void *release_data;
+    /* lines pulled one at a time, see Console_SetOutputGenerator */
+    Console_GeneratorFunction generator;
+    Console_FinishFunction generator_finish;
+    void *generator_state;
+    /* the next output being set, see _Console_begin_output */
+    struct _Console_Output *next_set;
+} Console_Output;
+
 typedef struct _SDL_console_line {
     char *input;
-    char *output;
+    /*
+     * The output isn't NUL-terminated. It's given back with `release', which
+     * is _Console_free_text for output the line owns, or is interned.
+     */
+    const char *output;
+    size_t output_len;
+    Console_ReleaseFunction release;
+    void *release_data;
+    bool interned;         /* output is a Console_Interned's text */
+    bool output_only;      /* pulled from a generator, shown without prompt */
+    /* whether the line matches the filter of generation `match_gen' */
+    bool match;
+    unsigned match_gen;
+    int repeat;            /* times the line ran in a row, shown as (xN) */
     int len;
     GLfloat w;
     GLfloat h;
-    GLuint texture;
+    GLuint texture;        /* 0 until rasterized or after being evicted */
+    int tex_w, tex_h;      /* size the texture's storage was made for */
+    /* colored runs of the text in the texture, in layout order */
+    Console_Span *spans;
+    int num_spans;
+    int max_spans;
     struct _SDL_console_line *next;
     struct _SDL_console_line *prev;
 } Console_Line;
 
+/*
+ * Recordings start with this and the console's size, then hold records of a
+ * type byte, the microseconds since the last record as a varint, and the
+ * record's fields.
+ */
+#define CONSOLE_REC_MAGIC      "SDLCREC\001"
+#define CONSOLE_REC_MAGIC_LEN  8
+
+enum Console_Rec_Type {
+    CONSOLE_REC_KEY = 1,   /* key and modifiers */
+    CONSOLE_REC_TEXT,      /* text input: length byte and the text */
+    CONSOLE_REC_RESIZE,    /* window width and height */
+    CONSOLE_REC_FRAME,     /* Console_Draw */
+    CONSOLE_REC_OUTPUT,    /* input function: flags, length and output */
+    CONSOLE_REC_LINE       /* generator: flags, length and line */
+};
+
+/* Flags of output and line records */
+#define CONSOLE_REC_FAILED     0x1
+#define CONSOLE_REC_GENERATOR  0x2
+#define CONSOLE_REC_HAS_TEXT   0x4
+#define CONSOLE_REC_MORE       0x8
+
+/* A recording being replayed, loaded whole */
+typedef struct _Console_Playback {
+    unsigned char *data;
+    size_t len;
+    size_t pos;
+    Uint64 time;           /* microseconds into the recording */
+} Console_Playback;
+
+/* Events a trace holds unless told otherwise, and GPU frames in flight */
+#define CONSOLE_TRACE_EVENTS   65536
+#define CONSOLE_TRACE_QUERIES  8
+
+/*
+ * A traced span of work. `seq' is the event's index plus one once it's
+ * written, so a reader can tell a slot that's being written from a finished
+ * one.
+ */
+typedef struct _Console_TraceEvent {
+    SDL_atomic_t seq;
+    const char *name;
+    Uint64 start;          /* performance counter ticks */
+    Uint64 end;
+    SDL_threadID thread;
+    bool gpu;
+} Console_TraceEvent;
+
+/*
+ * Trace events go in a ring that threads claim slots of with an atomic add,
+ * so recording never waits; once full the oldest events are written over.
+ * GPU time is measured with pairs of timestamp queries at the start and end
+ * of a frame, read back a few frames later.
+ */
+typedef struct _Console_Trace {
+    Console_TraceEvent *events;
+    unsigned capacity;
+    SDL_atomic_t next;
+    bool gpu;
+    GLuint queries[CONSOLE_TRACE_QUERIES][2];
+    int query_first;       /* oldest frame being timed */
+    int query_count;
+    /* a GPU timestamp and the performance counter at the same moment */
+    GLint64 gpu_base;
+    Uint64 cpu_base;
+} Console_Trace;
+
+/* What the console did, with times in performance counter ticks */
+typedef struct _Console_StatCounters {
+    Uint64 draw_calls;
+    Uint64 texture_uploads;
+    Uint64 texture_bytes;
+    Uint64 glyphs;
+    Uint64 lines_rebuilt;
+    Uint64 render_time;
+    Uint64 layout_time;
+    Uint64 input_time;
+    Uint64 lock_time;
+} Console_StatCounters;
+
+/*
+ * The session log wakes its writer once this much is waiting, or after
+ * CONSOLE_LOG_FLUSH ms, and holds at most CONSOLE_LOG_BUFFER bytes.
+ */
+#define CONSOLE_LOG_WAKE   65536
+#define CONSOLE_LOG_FLUSH  1000
+#define CONSOLE_LOG_BUFFER (4 << 20)
+
+/*
+ * Commands and output are added to `buf' under the log's own mutex. The
+ * writer thread swaps it for `spare' and writes that out unlocked, so the
+ * console never waits for the disk. If the writer falls behind, text is
+ * dropped and counted instead.
+ */
+typedef struct _Console_Log {
+    char *path;
+    /* names of rotated files are made here */
+    char *from;
+    char *to;
+    FILE *file;
+    size_t size;       /* of the file being written */
+    size_t max_size;   /* the file is rotated past this, 0 for never */
+    int keep;          /* rotated files kept */
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    char *buf;
+    size_t len;
+    size_t max;
+    char *spare;
+    size_t spare_max;
+    size_t dropped;
+    bool stop;
+    SDL_Thread *thread;
+} Console_Log;
+
+/* files of commands `exec' may have running at once */
+#define CONSOLE_EXEC_DEPTH 16
+
+#define CONSOLE_REMOTE_CLIENTS 16
+/* bytes read from a client at a time */
+#define CONSOLE_REMOTE_READ 65536
+/*
+ * A client isn't read from while this much of what it sent hasn't run, and
+ * its commands wait while this much output hasn't been sent, so a client
+ * that doesn't keep up only slows itself down.
+ */
+#define CONSOLE_REMOTE_BUFFER (1 << 20)
+/* output made for a client each time it's served, so others get a turn */
+#define CONSOLE_REMOTE_BATCH  65536
+
+typedef struct _Console_RemoteClient {
+    int fd;
+    /* received but not yet run */
+    char *in;
+    int in_len;
+    int in_max;
+    /* output waiting to be sent from `out_sent' on */
+    char *out;
+    int out_len;
+    int out_max;
+    int out_sent;
+    /* it sent everything it's going to */
+    bool eof;
+    /* it can't be written to any more */
+    bool broken;
+    /*
+     * Pulled from a page at a time while there's room in `out'; the client's
+     * next command waits until it runs out.
+     */
+    Console_GeneratorFunction generator;
+    Console_FinishFunction generator_finish;
+    void *generator_state;
+} Console_RemoteClient;
+
+/*
+ * The socket commands come in on. Clients are served with poll() from
+ * Console_Draw, or from a thread of their own which is woken through the
+ * `wake' pipe.
+ */
+typedef struct _Console_Remote {
+    Console_tty *tty;
+    int fd;
+    char *path;
+    bool bound;
+    Console_RemoteClient clients[CONSOLE_REMOTE_CLIENTS];
+    int num_clients;
+    /* the client whose command is running, which gets its output */
+    Console_RemoteClient *running;
+    SDL_Thread *thread;
+    SDL_atomic_t stop;
+    int wake[2];
+} Console_Remote;
+
 struct _SDL_console_tty {
-    Console_Font font;
+    /* the font in use, which is one of the cached fonts */
+    Console_Font *font;
+    /* every font loaded so far, keyed by path and size */
+    Console_Font *fonts;
+    /* the font asked for by Console_SetFont, NULL once it's in use */
+    char *want_font_path;
+    int want_font_size;
+    /* the size given to Console_Create, which zooming resets to */
+    int base_font_size;
+    Console_FontLoad *font_load;
 
     const char *prompt;
     int prompt_len;
@@ -104,14 +722,66 @@ struct _SDL_console_tty {
     GLuint shader_prog;
     GLuint vert_shader;
     GLuint frag_shader;
-    /* 1x1 textures which hold the opacity values for the cursor & bg color */
-    GLuint cursor_texture;
-    GLuint bg_texture;
+    /* uniform locations are looked up once in _Console_init_gl */
+    GLint projection_loc;
+    Console_GLState gl_state;
+    Console_Batch batch;
+    /* spare line textures and the size of their storage */
+    struct { GLuint texture; int w, h; } pool[CONSOLE_POOL_MAX];
+    int pool_len;
+    /* storage of the line textures, pooled ones included */
+    size_t texture_bytes;
+    /* GPU memory the console may use, 0 for no limit */
+    size_t gpu_budget;
+    /* GL resources are created when the console is first drawn */
+    bool gl_ready;
+    /*
+     * Headless consoles have no window or GL. They're drawn in software into
+     * `frame', RGBA rows from the top of the window down. The frame keeps
+     * the size it was drawn at until the next one is drawn.
+     */
+    bool headless;
+    unsigned char *frame;
+    int frame_width;
+    int frame_height;
+
+    /* counted for the frame being drawn, the last frame, and in all */
+    Console_StatCounters stats;
+    Console_StatCounters stats_frame;
+    Console_StatCounters stats_total;
+    Uint64 stats_frames;
+    /* glyphs rendered by every font when the last frame ended */
+    Uint64 stats_glyphs;
+    /* NULL unless tracing */
+    Console_Trace *trace;
+    /* events and outputs are written here while recording */
+    FILE *record;
+    Uint64 record_last;
+    bool replaying;
+    /* NULL unless listening for remote commands */
+    Console_Remote *remote;
+    /* NULL unless logging the session */
+    Console_Log *log;
+
+    Console_RenderMode render_mode;
+    Console_Grid grid;
+    /* size of a cell on screen, which the grid can scale */
+    GLfloat cell_width;
+    GLfloat cell_height;
+    /* the font size shown in CONSOLE_RENDER_SDF */
+    int sdf_size;
+    /* line textures were skipped while the grid renderer was in use */
+    bool rebuild_textures;
 
     /* doubly linked-list of lines */
     Console_Line *lines_head;
     Console_Line *lines_tail;
     Console_Line *curr_line;
+    /*
+     * The line recalled from history when a command was run for a file or a
+     * client, put back afterwards unless it's been taken off the list.
+     */
+    Console_Line *saved_line;
 
     int num_lines;  /* current number of lines */
     int max_lines;  /* max numbers of lines allowed */
@@ -121,6 +791,53 @@ struct _SDL_console_tty {
 
     bool rebuild_line;
 
+    /* rows the view is scrolled up from the bottom */
+    int scroll;
+    /*
+     * While filtering, the filter is typed into a line of its own that takes
+     * the place of the current line, and only lines that match are shown.
+     * The generation goes up every time the filter changes.
+     */
+    Console_Line *filter_line;
+    unsigned filter_gen;
+    bool filter_changed;
+    /* where the last command's output is still being pulled from */
+    Console_GeneratorFunction generator;
+    Console_FinishFunction generator_finish;
+    void *generator_state;
+
+    /*
+     * Frame times in milliseconds, the oldest at `frame_time_next' once the
+     * ring is full. They're timed between calls to Console_Draw unless the
+     * program gives them.
+     */
+    float frame_times[CONSOLE_FRAME_TIMES];
+    int frame_time_next;
+    int num_frame_times;
+    bool frame_times_given;
+    Uint64 last_draw;
+    bool frame_graph;
+    /* commands like `perf' are run by the console itself */
+    bool builtins;
+    /* a file `exec' opened, and how many files of commands are running */
+    FILE *exec_file;
+    int exec_depth;
+    /* the input function or a generator is being called */
+    bool in_command;
+    bool in_generator;
+    /*
+     * An error came up in an event watch, which can't return it, so
+     * Console_Draw fails from then on. Errors returned to the caller don't
+     * set this.
+     */
+    bool failed;
+
+    /* a line that repeats the one before it only counts up its repeats */
+    bool collapse_repeats;
+    /* outputs are shared between lines when interning is on */
+    bool intern_output;
+    Console_Interned *interned[CONSOLE_INTERN_BUCKETS];
+
     /* the function to which the input text is passed */
     Console_InputFunction input_func;
     /* this data is passed along with the input text to the input_func */
@@ -134,989 +851,6837 @@ struct _SDL_console_tty {
 };
 
 /*
- * Updates the texture given with the input and prompt and also the output, if
- * not null. This *will* changed the values w & h with the width and height of
- * the texture as the input, prompt, and output change lengths to vary the size
- * of the texture.
+ * Query the current value of one of the tracked GL states.
  */
-int
-_Console_update_line_texture (
-        Console_tty *tty,
-        Console_Line *line,
-        Console_Line *texture_line)
+GLint
+_Console_gl_query (Console_GLState *gs, enum Console_GL_State state)
 {
-    assert(tty);
-    assert(line);
-    assert(texture_line);
-
-    Console_Font *font = &tty->font;
-    GLfloat advance = font->char_width;
-    GLfloat x = 0.0f;
-    GLfloat y = 0.0f;
-    float offset = 0.0f;
-    int len = 0;
-    int i;
+    GLint v = 0;
+    GLboolean b;
 
-    if (line->output) {
-        /* +1 for the newline character inserted as sentinel */
-        len = tty->prompt_len + line->len + 1 + strlen(line->output);
-        /* again +1.0f for newline */
-        offset = 1.0f;
-    } else {
-        len = tty->prompt_len + line->len;
+    switch (state) {
+    case CONSOLE_GL_PROGRAM:
+        glGetIntegerv(GL_CURRENT_PROGRAM, &v);
+        break;
+    case CONSOLE_GL_VERTEX_ARRAY:
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &v);
+        break;
+    case CONSOLE_GL_ARRAY_BUFFER:
+        glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &v);
+        break;
+    case CONSOLE_GL_ACTIVE_TEXTURE:
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &v);
+        break;
+    case CONSOLE_GL_TEXTURE_2D:
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &v);
+        break;
+    case CONSOLE_GL_TEXTURE_BUFFER:
+        /* only ever touched while the second unit is active */
+        glGetIntegerv(GL_TEXTURE_BINDING_BUFFER, &v);
+        break;
+    case CONSOLE_GL_UNPACK_ALIGNMENT:
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &v);
+        break;
+    case CONSOLE_GL_BLEND:
+        glGetBooleanv(GL_BLEND, &b);
+        v = b;
+        break;
+    case CONSOLE_GL_BLEND_FUNC:
+        /* 1 if the blend func is already the console's own */
+        glGetIntegerv(GL_BLEND_SRC_RGB, &gs->saved_blend[0]);
+        glGetIntegerv(GL_BLEND_DST_RGB, &gs->saved_blend[1]);
+        glGetIntegerv(GL_BLEND_SRC_ALPHA, &gs->saved_blend[2]);
+        glGetIntegerv(GL_BLEND_DST_ALPHA, &gs->saved_blend[3]);
+        v = gs->saved_blend[0] == GL_SRC_ALPHA &&
+            gs->saved_blend[1] == GL_ONE_MINUS_SRC_ALPHA &&
+            gs->saved_blend[2] == GL_SRC_ALPHA &&
+            gs->saved_blend[3] == GL_ONE_MINUS_SRC_ALPHA;
+        break;
+    case CONSOLE_GL_CULL_FACE:
+        glGetBooleanv(GL_CULL_FACE, &b);
+        v = b;
+        break;
+    default:
+        break;
     }
 
-    line->w = tty->wrap_len * font->char_width;
-    line->h = 
-        (ceil((float)len / (float)tty->wrap_len) + offset) * font->line_height;
-
-    /* set of `empty' pixels to clear texture */
-    unsigned char empty[(int)(line->w * line->h)];
-    memset(empty, 0, (int)(line->w * line->h));
-
-    /* string buffer to output characters from */
-    char str[len];
-    memset(str, 0, len);
-    strcpy(str, tty->prompt);
-    strcat(str, line->input);
+    return v;
+}
 
-    /* insert newline sentinel and then output */
-    if (line->output) {
-        strcat(str, "\n");
-        strcat(str, line->output);
+/*
+ * Actually make the GL call for a state. The blend func is the only state
+ * with more than one value. Its tracked value is just 1 for the console's own
+ * func and anything else is restored from the saved pairs.
+ */
+void
+_Console_gl_apply (Console_GLState *gs, enum Console_GL_State state, 
+        GLint v, bool restoring)
+{
+    switch (state) {
+    case CONSOLE_GL_PROGRAM:
+        glUseProgram(v);
+        break;
+    case CONSOLE_GL_VERTEX_ARRAY:
+        glBindVertexArray(v);
+        break;
+    case CONSOLE_GL_ARRAY_BUFFER:
+        glBindBuffer(GL_ARRAY_BUFFER, v);
+        break;
+    case CONSOLE_GL_ACTIVE_TEXTURE:
+        glActiveTexture(v);
+        break;
+    case CONSOLE_GL_TEXTURE_2D:
+        glBindTexture(GL_TEXTURE_2D, v);
+        break;
+    case CONSOLE_GL_TEXTURE_BUFFER:
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, v);
+        glActiveTexture(gs->current[CONSOLE_GL_ACTIVE_TEXTURE]);
+        break;
+    case CONSOLE_GL_UNPACK_ALIGNMENT:
+        glPixelStorei(GL_UNPACK_ALIGNMENT, v);
+        break;
+    case CONSOLE_GL_BLEND:
+        if (v)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+        break;
+    case CONSOLE_GL_BLEND_FUNC:
+        if (restoring && !v)
+            glBlendFuncSeparate(gs->saved_blend[0], gs->saved_blend[1],
+                                gs->saved_blend[2], gs->saved_blend[3]);
+        else
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        break;
+    case CONSOLE_GL_CULL_FACE:
+        if (v)
+            glEnable(GL_CULL_FACE);
+        else
+            glDisable(GL_CULL_FACE);
+        break;
+    default:
+        break;
     }
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture_line->texture);
-
-    /* Resize the texture if needed and set any attributes */
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, 
-            line->w, line->h, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    /* Clear the texture */
-    glTexSubImage2D(GL_TEXTURE_2D, 
-            0, 0, 0, line->w, line->h, GL_RED, GL_UNSIGNED_BYTE, empty);
-
-    for (i = 0; i < len; i++) {
-        if (FT_Load_Char(font->face, str[i], FT_LOAD_RENDER))
-            continue;
-
-        GLfloat bearingY = font->face->glyph->bitmap_top;
-
-        if (x + advance > line->w || str[i] == '\n') {
-            y += font->line_height;
-            x = 0.0f;
-
-            if (str[i] == '\n')
-                continue;
-        }
-
-        if (str[i] == ' ')
-            goto next;
-
-        /*
-         * Every character has a different bearing. To account for that we use
-         * the current line (y) and add in the line height as a buffer. In that
-         * buffer can each character be placed at different y values so they
-         * all appear in the same baseline.
-         */
-        GLfloat ypos = y + font->line_height - bearingY - font->baseline - 1.0f;
+/*
+ * Lock the console, counting the time spent waiting for another thread.
+ * Returns 0 once locked like SDL_LockMutex.
+ */
+int
+_Console_lock (Console_tty *tty)
+{
+#ifndef CONSOLE_NO_STATS
+    Uint64 start;
 
-        /*
-         * We also make sure to use SubImage here because we're actually 
-         * appending to the previously created texture.
-         */
-        glTexSubImage2D(
-            GL_TEXTURE_2D, 
-            0, 
-            x, 
-            ypos,
-            font->face->glyph->bitmap.width,
-            font->face->glyph->bitmap.rows,
-            GL_RED,
-            GL_UNSIGNED_BYTE, 
-            font->face->glyph->bitmap.buffer
-        );
-
-    next:
-        x += advance;
-    }
-
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if (SDL_TryLockMutex(tty->mutex) == 0)
+        return 0;
+    start = SDL_GetPerformanceCounter();
+    if (SDL_LockMutex(tty->mutex) != 0)
+        return -1;
+    CONSOLE_STAT_SINCE(tty, lock_time, start);
     return 0;
+#else
+    return SDL_LockMutex(tty->mutex);
+#endif
 }
 
+/*
+ * Close the frame's counters: they become the last frame's and are added to
+ * the totals.
+ */
 void
-_Console_render_background (Console_tty *tty)
+_Console_end_frame_stats (Console_tty *tty)
 {
-    GLfloat xpos = 0.0f;
-    GLfloat ypos = 0.0f;
-    GLfloat ww   = tty->window_width;
-    GLfloat wh   = tty->window_height;
-    GLfloat vertices[6][4] = {
-        { xpos,      ypos + wh, 0.0f, 0.0f},
-        { xpos,      ypos,      0.0f, 1.0f},
-        { xpos + ww, ypos,      1.0f, 1.0f},
-                                         
-        { xpos,      ypos + wh, 0.0f, 0.0f},
-        { xpos + ww, ypos,      1.0f, 1.0f},
-        { xpos + ww, ypos + wh, 1.0f, 0.0f}
-    };
-    glUniform3f(glGetUniformLocation(tty->shader_prog, "textColor"),
-            tty->bg_color.r, tty->bg_color.g, tty->bg_color.b);
-    glBindTexture(GL_TEXTURE_2D, tty->bg_texture);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+#ifndef CONSOLE_NO_STATS
+    Console_StatCounters *c = &tty->stats, *t = &tty->stats_total;
+    Console_Font *font;
+    Uint64 glyphs = 0;
+
+    /* fonts may be rendering on another thread so glyphs are counted here */
+    for (font = tty->fonts; font; font = font->next)
+        glyphs += (Uint32)SDL_AtomicGet(&font->rendered);
+    c->glyphs = glyphs > tty->stats_glyphs ? glyphs - tty->stats_glyphs : 0;
+    tty->stats_glyphs = glyphs;
+
+    t->draw_calls += c->draw_calls;
+    t->texture_uploads += c->texture_uploads;
+    t->texture_bytes += c->texture_bytes;
+    t->glyphs += c->glyphs;
+    t->lines_rebuilt += c->lines_rebuilt;
+    t->render_time += c->render_time;
+    t->layout_time += c->layout_time;
+    t->input_time += c->input_time;
+    t->lock_time += c->lock_time;
+    tty->stats_frame = *c;
+    tty->stats_frames++;
+    memset(c, 0, sizeof(*c));
+#endif
+}
+
+/*
+ * The start of a span of work to trace, or 0 if not tracing.
+ */
+Uint64
+_Console_trace_begin (Console_tty *tty)
+{
+    return tty->trace ? SDL_GetPerformanceCounter() : 0;
 }
 
+/*
+ * Record an event that ran from `start' to `end'. Safe to call from any
+ * thread while the trace exists.
+ */
 void
-_Console_render_cursor (Console_tty *tty)
+_Console_trace_event (Console_Trace *t, const char *name, Uint64 start,
+        Uint64 end, bool gpu)
 {
-    /* cursor's position */
-    int cursor_len  = tty->cursor + tty->prompt_len;
-    GLfloat lh = tty->font.line_height;
-    GLfloat cw = tty->font.char_width;
-    /* the cursor's length within the line wrapped by max line characters */
-    GLfloat cx = (float)((cursor_len % tty->wrap_len) * tty->font.char_width);
-    /* The number of total lines minus the lines of cursor times line height */
-    GLfloat cy = ((tty->lines_head->h / lh) - 
-                 (float)((cursor_len / tty->wrap_len) + 1)) * lh;
-    GLfloat cursor_vert[6][4] = {
-        { cx,      cy + lh, 0.0f, 0.0f},
-        { cx,      cy,      0.0f, 1.0f},
-        { cx + cw, cy,      1.0f, 1.0f},
-
-        { cx,      cy + lh, 0.0f, 0.0f},
-        { cx + cw, cy,      1.0f, 1.0f},
-        { cx + cw, cy + lh, 1.0f, 0.0f}
-    };
-    /* Draw the cursor */
-    glUniform3f(glGetUniformLocation(tty->shader_prog, "textColor"),
-            tty->font_color.r, tty->font_color.g, tty->font_color.b);
-    glBindTexture(GL_TEXTURE_2D, tty->cursor_texture);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(cursor_vert), cursor_vert);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    unsigned i = (unsigned)SDL_AtomicAdd(&t->next, 1);
+    Console_TraceEvent *e = &t->events[i % t->capacity];
+
+    SDL_AtomicSet(&e->seq, 0);
+    e->name = name;
+    e->start = start;
+    e->end = end;
+    e->thread = SDL_ThreadID();
+    e->gpu = gpu;
+    SDL_AtomicSet(&e->seq, (int)(i + 1));
 }
 
+/*
+ * Record the span of work named `name' started at `start'.
+ */
 void
-_Console_render_lines (Console_tty *tty)
+_Console_trace_end (Console_tty *tty, const char *name, Uint64 start)
 {
-    Console_Line *l = tty->curr_line;
-    GLfloat xpos = 0.0f;
-    GLfloat ypos = 0.0f;
-    glUniform3f(glGetUniformLocation(tty->shader_prog, "textColor"),
-            1.0f, 1.0f, 1.0f);
-    for (l = tty->lines_head; l; l = l->next) {
-        GLfloat vertices[6][4] = {
-            { xpos,        ypos + l->h, 0.0f, 0.0f},
-            { xpos,        ypos,        0.0f, 1.0f},
-            { xpos + l->w, ypos,        1.0f, 1.0f},
-                                             
-            { xpos,        ypos + l->h, 0.0f, 0.0f},
-            { xpos + l->w, ypos,        1.0f, 1.0f},
-            { xpos + l->w, ypos + l->h, 1.0f, 0.0f}
-        };
-        glBindTexture(GL_TEXTURE_2D, l->texture);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        ypos += l->h;
-    }
+    if (tty->trace && start)
+        _Console_trace_event(tty->trace, name, start,
+                SDL_GetPerformanceCounter(), false);
 }
 
+/*
+ * Record GPU time of the frames whose timestamps have come back, then mark
+ * the start of this frame if there's a free pair of queries. Returns the
+ * pair to mark the end of the frame with, or -1.
+ */
 int
-Console_Render (Console_tty *tty)
+_Console_trace_gpu_begin (Console_tty *tty)
 {
-    assert(tty);
-
-    if (tty->rebuild_line) {
-        tty->rebuild_line = false;
-        if (_Console_update_line_texture(tty, tty->curr_line, tty->lines_head))
-            return 1;
+    Console_Trace *t = tty->trace;
+    GLint available;
+    GLint64 t0, t1;
+    GLuint *q;
+    double scale;
+    int slot;
+
+    if (!t || !t->gpu)
+        return -1;
+
+    scale = SDL_GetPerformanceFrequency() / 1e9;
+    while (t->query_count > 0) {
+        q = t->queries[t->query_first];
+        glGetQueryObjectiv(q[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        glGetQueryObjecti64v(q[0], GL_QUERY_RESULT, &t0);
+        glGetQueryObjecti64v(q[1], GL_QUERY_RESULT, &t1);
+        /* put the GPU's clock on the performance counter's */
+        _Console_trace_event(t, "Console_Render",
+                t->cpu_base + (Sint64)((t0 - t->gpu_base) * scale),
+                t->cpu_base + (Sint64)((t1 - t->gpu_base) * scale), true);
+        t->query_first = (t->query_first + 1) % CONSOLE_TRACE_QUERIES;
+        t->query_count--;
     }
 
-    /* set all options, programs, and buffers to draw our lines and cursor */
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glUseProgram(tty->shader_prog);
-    glBindVertexArray(tty->VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, tty->VBO);
-    glActiveTexture(GL_TEXTURE0);
+    if (t->query_count == CONSOLE_TRACE_QUERIES)
+        return -1;
+    slot = (t->query_first + t->query_count) % CONSOLE_TRACE_QUERIES;
+    glQueryCounter(t->queries[slot][0], GL_TIMESTAMP);
+    return slot;
+}
 
-    /* set buffer size */
-    glBufferData(GL_ARRAY_BUFFER, 
-            sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
+void
+_Console_trace_gpu_end (Console_tty *tty, int slot)
+{
+    if (slot < 0)
+        return;
+    glQueryCounter(tty->trace->queries[slot][1], GL_TIMESTAMP);
+    tty->trace->query_count++;
+}
 
-    _Console_render_background(tty);
-    _Console_render_lines(tty);
-    _Console_render_cursor(tty);
+/*
+ * Create the timestamp queries once there's a GL context, if the driver
+ * has them.
+ */
+void
+_Console_trace_init_gpu (Console_tty *tty)
+{
+    Console_Trace *t = tty->trace;
 
-    /* unset all of the set we set  */
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-    glUseProgram(0);
-    glDisable(GL_BLEND);
-    glDisable(GL_CULL_FACE);
+    if (!t || t->gpu || !tty->gl_ready ||
+            !SDL_GL_ExtensionSupported("GL_ARB_timer_query"))
+        return;
+    glGenQueries(CONSOLE_TRACE_QUERIES * 2, &t->queries[0][0]);
+    glGetInteger64v(GL_TIMESTAMP, &t->gpu_base);
+    t->cpu_base = SDL_GetPerformanceCounter();
+    t->query_first = 0;
+    t->query_count = 0;
+    t->gpu = true;
+}
 
-    return 0;
+void
+_Console_trace_free (Console_tty *tty)
+{
+    Console_Trace *t = tty->trace;
+
+    if (!t)
+        return;
+    if (t->gpu && tty->gl_ready)
+        glDeleteQueries(CONSOLE_TRACE_QUERIES * 2, &t->queries[0][0]);
+    free(t->events);
+    free(t);
+    tty->trace = NULL;
 }
 
 /*
- * Set the current line. We can go UP (next) or DOWN (previous) through the 
- * lines. This function essentially acts as a history viewer. This function
- * will skip lines with zero length. The cursor is always set to the length of
- * the line's input.
+ * Begin a section of GL calls. Sections can nest and only the outermost
+ * section's end will restore the state.
  */
-enum Console_Line_Dir { LINE_UP, LINE_DOWN }; 
 void
-Console_SetCurrLine (Console_tty *tty, enum Console_Line_Dir dir)
+_Console_gl_begin (Console_tty *tty)
 {
-    Console_Line *line;
+    Console_GLState *gs = &tty->gl_state;
+    if (gs->depth++ == 0)
+        gs->touched = 0;
+}
 
-    for (line = (dir == LINE_UP ? tty->curr_line->next : tty->curr_line->prev);
-         line != NULL;
-         line = (dir == LINE_UP ? line->next : line->prev))
-    {
-        if (line == tty->lines_head || line->len > 0)
-            break;
+/*
+ * Set a tracked state, skipping the call if the state already has the value.
+ * The first time a state is touched in a section its value is saved: the
+ * value last known or queried from GL when restoring is on, GL's default
+ * otherwise. GL is only queried when the value isn't known.
+ */
+void
+_Console_gl_set (Console_tty *tty, enum Console_GL_State state, GLint v)
+{
+    Console_GLState *gs = &tty->gl_state;
+    unsigned bit = 1 << state;
+
+    assert(gs->depth > 0);
+
+    if (!(gs->touched & bit)) {
+        gs->touched |= bit;
+        if (!(gs->known & bit)) {
+            gs->known |= bit;
+            if (gs->restore)
+                gs->current[state] = _Console_gl_query(gs, state);
+            else
+                /* force the first call as the real value is unknown */
+                gs->current[state] = ~v;
+        }
+        gs->saved[state] = gs->restore ? gs->current[state] : 0;
     }
 
-    if (line == NULL)
+    if (gs->current[state] == v)
         return;
 
-    tty->curr_line = line;
-    tty->curr_line->len = line->len;
-    tty->cursor = line->len;
-    tty->rebuild_line = true;
+    gs->current[state] = v;
+    _Console_gl_apply(gs, state, v, false);
 }
 
 /*
- * Create a new line and set it to be the head. This function will 
- * automatically cycle-out lines if the number of lines has reached the max.
- * If this function returns 0, the tty->lines_head will be a new line and 
- * tty->lines_head->next is previous line.
+ * End a section of GL calls. The outermost end puts back every state that was
+ * touched, in reverse order.
  */
-int
-_Console_create_line (Console_tty *tty)
+void
+_Console_gl_end (Console_tty *tty)
 {
-    assert(tty);
-    Console_Line *line = NULL;
+    Console_GLState *gs = &tty->gl_state;
+    int i;
 
-    line = malloc(sizeof(*line));
-    if (!line) {
-        Console_SetError("Not enough memory to create line!", "");
-        return 1;
-    }
+    assert(gs->depth > 0);
+    if (--gs->depth > 0)
+        return;
 
-    line->input = malloc(sizeof(*line->input) * tty->max_input);
-    if (!line->input) {
-        Console_SetError("Not enough memory to create line text!", "");
-        free(line);
-        return 1;
+    for (i = CONSOLE_GL_STATE_MAX - 1; i >= 0; i--) {
+        if (!(gs->touched & (1 << i)))
+            continue;
+        if (!gs->restore && (CONSOLE_GL_KEEP_MASK & (1 << i)))
+            continue;
+        if (gs->current[i] != gs->saved[i]) {
+            _Console_gl_apply(gs, i, gs->saved[i], true);
+            gs->current[i] = gs->saved[i];
+        }
     }
+    gs->touched = 0;
+}
 
-    memset(line->input, 0, tty->max_input);
-    glGenTextures(1, &line->texture);
-    line->output = NULL;
-    line->len = 0;
-    line->w = 0;
-    line->h = 0;
+/*
+ * Bind a texture to the first texture unit.
+ */
+void
+_Console_gl_bind_texture (Console_tty *tty, GLuint texture)
+{
+    _Console_gl_set(tty, CONSOLE_GL_ACTIVE_TEXTURE, GL_TEXTURE0);
+    _Console_gl_set(tty, CONSOLE_GL_TEXTURE_2D, texture);
+}
 
-    /* insert into the doubly-linked list */
-    if (tty->lines_head == NULL) {
-        line->next = NULL;
-        line->prev = NULL;
-        tty->lines_head = line;
-        tty->lines_tail = line;
-        tty->num_lines  = 0;
-    } else {
-        line->prev = NULL;
-        line->next = tty->lines_head;
-        tty->lines_head->prev = line;
-        tty->lines_head = line;
-    }
+/*
+ * Delete a texture. GL unbinds a texture when it's deleted so the tracked
+ * binding is cleared with it.
+ */
+void
+_Console_gl_delete_texture (Console_tty *tty, GLuint *texture)
+{
+    Console_GLState *gs = &tty->gl_state;
+    if ((gs->known & (1 << CONSOLE_GL_TEXTURE_2D)) &&
+        gs->current[CONSOLE_GL_TEXTURE_2D] == (GLint)*texture)
+        gs->current[CONSOLE_GL_TEXTURE_2D] = 0;
+    glDeleteTextures(1, texture);
+    *texture = 0;
+}
 
-    /* When the list is too long, start chopping the tail off each new line */
-    if (tty->num_lines == tty->max_lines) {
-        tty->lines_tail = tty->lines_tail->prev;
-        free(tty->lines_tail->next);
-        tty->lines_tail->next = NULL;
-    } else {
-        tty->num_lines++;
-    }
+/*
+ * Bind a buffer texture to the second texture unit.
+ */
+void
+_Console_gl_bind_buffer_texture (Console_tty *tty, GLuint texture)
+{
+    /* touching the unit first makes sure the binding is saved from it */
+    _Console_gl_set(tty, CONSOLE_GL_ACTIVE_TEXTURE, GL_TEXTURE1);
+    _Console_gl_set(tty, CONSOLE_GL_TEXTURE_BUFFER, texture);
+    _Console_gl_set(tty, CONSOLE_GL_ACTIVE_TEXTURE, GL_TEXTURE0);
+}
 
-    /* make sure the current line becomes the new line */
-    tty->curr_line = tty->lines_head;
-    tty->cursor = 0;
-    tty->rebuild_line = true;
+/*
+ * Grow an array to hold at least `n' elements of `size' bytes.
+ * Returns 1 if out of memory, 0 otherwise.
+ */
+int
+_Console_grow_array (void **array, int *max, int n, size_t size)
+{
+    void *p;
+    int new_max = *max > 0 ? *max : 64;
 
+    if (n <= *max)
+        return 0;
+    while (new_max < n)
+        new_max *= 2;
+    p = realloc(*array, new_max * size);
+    if (!p) {
+        Console_SetError("Not enough memory to grow array!", "");
+        return 1;
+    }
+    *array = p;
+    *max = new_max;
     return 0;
 }
 
+void
+_Console_batch_reset (Console_Batch *batch)
+{
+    batch->num_vertices = 0;
+    batch->num_draws = 0;
+}
+
 /*
- * When a newline occurs, we use the current line's text as input to the input
- * function given in Console(). We then render any output to that line's
- * texture which will be the final time that texture is updated (excluding
- * screen resizes and font changes).
+ * Add a quad from (x, y) to (x + w, y + h) to the batch. Texture coordinates
+ * go from (s0, t0) at the top left to (s1, t1) at the bottom right. Solid
+ * quads should pass a texture of 0 so they can join any draw.
+ * Returns 1 if out of memory, 0 otherwise.
  */
 int
-Console_NewLine (Console_tty *tty, 
-                 Console_InputFunction input_func,
-                 void *input_func_data)
+_Console_batch_quad (Console_Batch *batch, GLuint texture, 
+        GLfloat x, GLfloat y, GLfloat w, GLfloat h,
+        GLfloat s0, GLfloat t0, GLfloat s1, GLfloat t1,
+        Console_Color c, enum Console_Quad_Mode mode)
 {
-    char *output = NULL;
+    Console_Vertex *v;
+    Console_DrawCall *d;
 
-    /* Use the text from the current line as input to the function given */
-    if (tty->curr_line && tty->curr_line->len > 0 && input_func) {
-        if (input_func(tty->curr_line->input, input_func_data, &output)) {
-            Console_SetError("Console input function failed: ", output);
-            free(output);
-            return 1;
-        }
-        tty->curr_line->output = output;
+    if (_Console_grow_array((void**)&batch->vertices, &batch->max_vertices,
+                batch->num_vertices + 6, sizeof(*batch->vertices)))
+        return 1;
 
-        /* Then render the line a final time with the output */
-        if (_Console_update_line_texture(tty, tty->curr_line, tty->lines_head))
+    /* start a new draw only when the texture has to change */
+    d = batch->num_draws > 0 ? &batch->draws[batch->num_draws - 1] : NULL;
+    if (!d || (texture != 0 && d->texture != 0 && d->texture != texture)) {
+        if (_Console_grow_array((void**)&batch->draws, &batch->max_draws,
+                    batch->num_draws + 1, sizeof(*batch->draws)))
             return 1;
+        d = &batch->draws[batch->num_draws++];
+        d->texture = 0;
+        d->first = batch->num_vertices;
+        d->count = 0;
     }
+    if (texture != 0)
+        d->texture = texture;
+    d->count += 6;
 
-    /*
-     * If the newline came from history, copy that command to the current
-     * head to keep history consistent.
-     */
-    if (tty->lines_head != tty->curr_line) {
-        strcpy(tty->lines_head->input, tty->curr_line->input);
-        tty->lines_head->len = tty->curr_line->len;
-    }
+    v = &batch->vertices[batch->num_vertices];
+    batch->num_vertices += 6;
 
-    /* Finally, actually create a new line */
-    if (_Console_create_line(tty))
-        return 1;
+#define _Console_m_vertex(i,vx,vy,vs,vt) \
+    v[i] = (Console_Vertex) { vx, vy, vs, vt, c.r, c.g, c.b, c.a, mode };
+
+    _Console_m_vertex(0, x,     y + h, s0, t0);
+    _Console_m_vertex(1, x,     y,     s0, t1);
+    _Console_m_vertex(2, x + w, y,     s1, t1);
+    _Console_m_vertex(3, x,     y + h, s0, t0);
+    _Console_m_vertex(4, x + w, y,     s1, t1);
+    _Console_m_vertex(5, x + w, y + h, s1, t0);
+
+#undef _Console_m_vertex
 
     return 0;
 }
 
+/*
+ * Upload the batch and draw it. Expects the console's program, vertex array
+ * and buffer to be bound.
+ */
 void
-_Console_destroy_ft (Console_tty *tty)
+_Console_batch_draw (Console_tty *tty, Console_Batch *batch)
 {
-    assert(tty);
-    FT_Done_Face(tty->font.face);
-    FT_Done_FreeType(tty->font.ft);
+    GLsizeiptr size = batch->num_vertices * sizeof(*batch->vertices);
+    int i;
+
+    if (size > batch->vbo_size) {
+        glBufferData(GL_ARRAY_BUFFER, size, batch->vertices, GL_STREAM_DRAW);
+        batch->vbo_size = size;
+    } else {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, batch->vertices);
+    }
+
+    for (i = 0; i < batch->num_draws; i++) {
+        if (batch->draws[i].texture != 0)
+            _Console_gl_bind_texture(tty, batch->draws[i].texture);
+        glDrawArrays(GL_TRIANGLES, batch->draws[i].first, batch->draws[i].count);
+    }
+    CONSOLE_STAT_ADD(tty, draw_calls, batch->num_draws);
 }
 
 /*
- * Initialize the font.
- * TODO-FEATURE: extract the New_Face and Done_Face functions so we can change
- * fonts at run time.
+ * Decode the UTF-8 character starting at str[*i] and move *i past it.
+ * Malformed sequences decode to the replacement character one byte at a time.
  */
-int
-_Console_init_ft (Console_tty* tty, const char *font_path, const int font_size)
+Uint32
+_Console_utf8_decode (const char *str, int len, int *i)
 {
-    assert(tty);
+    const unsigned char *s = (const unsigned char*)str;
+    Uint32 c = s[*i];
+    int n, k;
 
-    FT_Library ft;
-    FT_Face face;
-    FT_Error e;
+    if (c < 0x80) {
+        *i += 1;
+        return c;
+    }
 
-    if ((e = FT_Init_FreeType(&ft))) {
-        Console_SetError("Freetype failed to init: ", FT_GetError(e));
-        return 1;
+    if (c >= 0xC2 && c <= 0xDF) {
+        n = 1;
+        c &= 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        n = 2;
+        c &= 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 3;
+        c &= 0x07;
+    } else {
+        *i += 1;
+        return CONSOLE_REPLACEMENT_CHAR;
     }
-    if ((e = FT_New_Face(ft, font_path, 0, &face))) {
-        Console_SetError("Freetype failed open font: ", FT_GetError(e));
-        FT_Done_FreeType(ft);
-        return 1;
+
+    /* truncated at the end of the text */
+    if (*i + n >= len) {
+        *i += 1;
+        return CONSOLE_REPLACEMENT_CHAR;
     }
 
-    tty->font.ft   = ft;
-    tty->font.face = face;
+    for (k = 1; k <= n; k++) {
+        if ((s[*i + k] & 0xC0) != 0x80) {
+            *i += 1;
+            return CONSOLE_REPLACEMENT_CHAR;
+        }
+        c = (c << 6) | (s[*i + k] & 0x3F);
+    }
 
-    if (!FT_IS_FIXED_WIDTH(face)) {
-        Console_SetError("Font must be fixed width (monospace)!", "");
-        _Console_destroy_ft(tty);
-        return 1;
+    /* overlong encodings, surrogates, and past the last codepoint */
+    if ((n == 2 && c < 0x800) || (n == 3 && c < 0x10000) || 
+            (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+        *i += 1;
+        return CONSOLE_REPLACEMENT_CHAR;
     }
 
-    if (!FT_IS_SCALABLE(face)) {
-        Console_SetError("Font isn't scalable!", "");
-        _Console_destroy_ft(tty);
+    *i += n + 1;
+    return c;
+}
+
+/*
+ * The number of characters in the first `len' bytes of UTF-8 text.
+ */
+int
+_Console_utf8_len (const char *str, int len)
+{
+    int n = 0;
+    int i;
+    for (i = 0; i < len; i++)
+        if (((unsigned char)str[i] & 0xC0) != 0x80)
+            n++;
+    return n;
+}
+
+/*
+ * Open the font file with FreeType at the font's size. Fonts loaded from a
+ * cache file only do this once they need a glyph the file doesn't have.
+ * Returns 1 on error with the reason written to `err', 0 otherwise.
+ */
+int
+_Console_open_face (Console_Font *font, char *err, size_t err_len)
+{
+    FT_Error e;
+
+    if ((e = FT_Init_FreeType(&font->ft))) {
+        snprintf(err, err_len, "Freetype failed to init: %s", FT_GetError(e));
+        font->ft = NULL;
+        return 1;
+    }
+    if ((e = FT_New_Face(font->ft, font->path, 0, &font->face))) {
+        snprintf(err, err_len, "Freetype failed open font: %s",
+                FT_GetError(e));
+        font->face = NULL;
         return 1;
     }
 
-    FT_Set_Pixel_Sizes(face, 0, font_size);
-
-    if ((e = FT_Load_Glyph(face, FT_Get_Char_Index(face, 'm'), 
-                    FT_LOAD_RENDER))) {
-        Console_SetError("Loading glyphs failed: ", FT_GetError(e));
-        _Console_destroy_ft(tty);
+    if (!FT_IS_FIXED_WIDTH(font->face)) {
+        snprintf(err, err_len, "Font must be fixed width (monospace)!");
         return 1;
     }
 
-    /* `>> 6' adjusts values which are based at 1/64th of screen pixel size */
-    tty->font.face = face;
-    tty->font.ft = ft;
-    tty->font.font_size = font_size;
-    tty->font.advance = (face->glyph->metrics.horiAdvance >> 6);
-    tty->font.char_width = 
-        (face->glyph->metrics.horiBearingX + face->glyph->metrics.width) >> 6;
-    tty->font.line_height = 
-          (FT_MulFix(face->ascender, face->size->metrics.y_scale) >> 6)
-        - (FT_MulFix(face->descender, face->size->metrics.y_scale) >> 6)
-        + 1;
-    tty->font.baseline = abs(face->descender) * font_size / face->units_per_EM;
+    if (!FT_IS_SCALABLE(font->face)) {
+        snprintf(err, err_len, "Font isn't scalable!");
+        return 1;
+    }
 
+    FT_Set_Pixel_Sizes(font->face, 0, font->font_size);
     return 0;
 }
 
+/*
+ * Render the glyph of codepoint `c' and copy it into `g'. Glyphs that fail to
+ * load are cached as empty so they aren't tried again.
+ */
 void
-_Console_destroy_gl (Console_tty *tty)
+_Console_load_glyph (Console_Font *font, Uint32 c, Console_Glyph *g)
 {
-    assert(tty);
-    Console_Line *line; 
-    for (line = tty->lines_head; line != NULL; line = line->next)
-        glDeleteTextures(1, &line->texture);
-	glDeleteTextures(1, &tty->cursor_texture);
-	glDeleteTextures(1, &tty->bg_texture);
-    glDeleteShader(tty->vert_shader);
-    glDeleteShader(tty->frag_shader);
-    glDeleteProgram(tty->shader_prog);
-	glDeleteBuffers(1, &tty->VBO);
-	glDeleteBuffers(1, &tty->VAO);
+    FT_GlyphSlot slot;
+    char err[256];
+    int y;
+
+    g->loaded = true;
+    font->num_glyphs++;
+    g->bitmap = NULL;
+    g->width = 0;
+    g->rows = 0;
+    g->top = 0;
+    g->left = 0;
+    g->slot = 0;
+    g->mapped = false;
+
+    /* a face that failed to open once isn't tried again */
+    if (!font->face && (font->ft || _Console_open_face(font, err, sizeof(err))))
+        return;
+    slot = font->face->glyph;
+
+#ifdef CONSOLE_HAVE_SDF
+    if (font->sdf) {
+        if (FT_Load_Char(font->face, c, FT_LOAD_DEFAULT) ||
+            FT_Render_Glyph(slot, FT_RENDER_MODE_SDF))
+            return;
+    } else
+#endif
+    if (FT_Load_Char(font->face, c, FT_LOAD_RENDER))
+        return;
+    SDL_AtomicAdd(&font->rendered, 1);
+    if (slot->bitmap.width == 0 || slot->bitmap.rows == 0)
+        return;
+
+    g->bitmap = malloc(slot->bitmap.width * slot->bitmap.rows);
+    if (!g->bitmap)
+        return;
+
+    g->width = slot->bitmap.width;
+    g->rows = slot->bitmap.rows;
+    g->top = slot->bitmap_top;
+    /* distance fields are padded by the spread */
+    if (font->sdf)
+        g->left = slot->bitmap_left - (slot->metrics.horiBearingX >> 6);
+    for (y = 0; y < g->rows; y++)
+        memcpy(g->bitmap + y * g->width, 
+               slot->bitmap.buffer + y * slot->bitmap.pitch, g->width);
 }
 
 /*
- * Get the window's size and all the vars that are associated with the window
- * size.
+ * Get the cache entry of codepoint `c', which may not be loaded yet.
+ * Returns NULL only if out of memory.
  */
-void
-_Console_set_window_size (Console_tty *tty)
+Console_Glyph*
+_Console_glyph_entry (Console_Font *font, Uint32 c)
 {
-    assert(tty);
-    assert(tty->window);
-    assert(tty->shader_prog > 0);
+    Console_GlyphPage *page;
+
+    page = font->pages[c >> CONSOLE_GLYPH_PAGE_BITS];
+    if (!page) {
+        page = calloc(1, sizeof(*page));
+        if (!page)
+            return NULL;
+        font->pages[c >> CONSOLE_GLYPH_PAGE_BITS] = page;
+    }
+    return &page->glyphs[c & (CONSOLE_GLYPH_PAGE_SIZE - 1)];
+}
 
-    SDL_GetWindowSize(tty->window, &tty->window_width, &tty->window_height);
-    /* wrap len needs to be updated before updating textures */
-    tty->wrap_len = 
-        roundf((float)tty->window_width / (float)tty->font.char_width);
+/*
+ * Get the glyph of codepoint `c', loading it the first time it's used.
+ * Returns NULL only if out of memory.
+ */
+Console_Glyph*
+_Console_get_glyph (Console_Font *font, Uint32 c)
+{
+    Console_Glyph *g;
 
-    glUseProgram(tty->shader_prog);
-    glViewport(0, 0, tty->window_width, tty->window_height);
+    if (c > 0x10FFFF)
+        c = CONSOLE_REPLACEMENT_CHAR;
 
-    /* 
-     * Setup 2D projection matrix for vertex shader.
-     * left, right, bottom, top
-     */
-    GLfloat l = 0.0f;
-    GLfloat r = (GLfloat)tty->window_width;
-    GLfloat b = 0.0f;
-    GLfloat t = (GLfloat)tty->window_height;
-    GLfloat orthoMatrix[4*4] = {
-        2.0f / (r - l),   0.0f,             0.0f, 0.0f,
-        0.0f,             2.0f / (t - b),   0.0f, 0.0f,
-        0.0f,             0.0f,            -1.0f, 0.0f,
-        -(r + l)/(r - l), -(t + b)/(t - b), 0.0f, 1.0f,
-    };
-    glUniformMatrix4fv(glGetUniformLocation(tty->shader_prog, "projection"),
-            1, GL_FALSE, orthoMatrix);
+    g = _Console_glyph_entry(font, c);
+    if (!g)
+        return NULL;
+    if (!g->loaded)
+        _Console_load_glyph(font, c, g);
+    return g;
+}
 
-    Console_Line *li;
-    for (li = tty->lines_head; li != NULL; li = li->next)
-        _Console_update_line_texture(tty, li, li);
+void
+_Console_destroy_glyphs (Console_Font *font)
+{
+    int i, j;
+    for (i = 0; i < CONSOLE_GLYPH_PAGES; i++) {
+        if (!font->pages[i])
+            continue;
+        for (j = 0; j < CONSOLE_GLYPH_PAGE_SIZE; j++)
+            if (!font->pages[i]->glyphs[j].mapped)
+                free(font->pages[i]->glyphs[j].bitmap);
+        free(font->pages[i]);
+        font->pages[i] = NULL;
+    }
+}
 
-    glUseProgram(0);
+/*
+ * Apply the parameters of an SGR escape code (`ESC [ ... m') to `attr'.
+ * Bold makes the 8 normal foreground colors bright.
+ */
+void
+_Console_apply_sgr (Console_Attr *attr, const int *params, int n)
+{
+    int i, p;
+
+    for (i = 0; i < n; i++) {
+        p = params[i];
+        if (p == 0) {
+            *attr = (Console_Attr) { 0, 0, false };
+        } else if (p == 1) {
+            attr->bold = true;
+            if (attr->fg >= 1 && attr->fg <= 8)
+                attr->fg += 8;
+        } else if (p == 22) {
+            attr->bold = false;
+        } else if (p >= 30 && p <= 37) {
+            attr->fg = p - 30 + 1 + (attr->bold ? 8 : 0);
+        } else if (p == 39) {
+            attr->fg = 0;
+        } else if (p >= 40 && p <= 47) {
+            attr->bg = p - 40 + 1;
+        } else if (p == 49) {
+            attr->bg = 0;
+        } else if (p >= 90 && p <= 97) {
+            attr->fg = p - 90 + 9;
+        } else if (p >= 100 && p <= 107) {
+            attr->bg = p - 100 + 9;
+        } else if ((p == 38 || p == 48) && i + 1 < n) {
+            /* only the palette's colors of `5;n' are supported */
+            if (params[i + 1] == 5 && i + 2 < n) {
+                if (params[i + 2] < 16) {
+                    if (p == 38)
+                        attr->fg = params[i + 2] + 1;
+                    else
+                        attr->bg = params[i + 2] + 1;
+                }
+                i += 2;
+            } else if (params[i + 1] == 2) {
+                i += 4;
+            }
+        }
+    }
 }
 
 /*
- * Load all of the OpenGL specific aspects of the tty. This includes the 
- * cursor's texture. The only things it doesn't handle is the texture of each
- * line (handled by Console_NewLine) and the cursor's texture 
- * (_Console_init_cursor). _Console_destroy_gl cleans up both of those.
+ * Parse the escape sequence starting at str[i]. SGR codes update `attr' and
+ * every other sequence is skipped.
+ * Returns the index of the sequence's last character.
  */
 int
-_Console_init_gl (Console_tty *tty, SDL_Window *window)
+_Console_parse_escape (const char *str, int len, int i, Console_Attr *attr)
 {
-    assert(tty);
-    assert(window);
-
-    GLuint VAO;
-    GLuint VBO;
-    GLuint shader_prog;
-    GLuint vert_shader;
-    GLuint frag_shader;
-
-    GLint  maxlength;
-    GLint  status;
-    GLint  posAttrib;
-
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
-            SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
-    /*SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);*/
-
-    glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-
-#define _Console_m_compile_shader(s,src,t) \
-    s = glCreateShader(t); \
-    glShaderSource(s, 1, &src, NULL); \
-    glCompileShader(s); \
-    glGetShaderiv(s, GL_COMPILE_STATUS, &status); \
-    if (status != GL_TRUE) { \
-        char buffer[512]; \
-        glGetShaderInfoLog(s, 512, NULL, buffer); \
-        Console_SetError("Shader failed to compile: ", buffer); \
-        return 1; \
+    int params[16];
+    int n = 0;
+    int p = 0;
+    bool has_p = false;
+
+    /* only control sequences are understood, a lone ESC is dropped */
+    if (i + 1 >= len || str[i + 1] != '[')
+        return i;
+
+    for (i += 2; i < len; i++) {
+        unsigned char c = str[i];
+        if (c >= '0' && c <= '9') {
+            p = p * 10 + (c - '0');
+            has_p = true;
+        } else if (c == ';') {
+            if (n < 16)
+                params[n++] = p;
+            p = 0;
+            has_p = false;
+        } else if (c >= 0x40 && c <= 0x7E) {
+            /* the final byte */
+            if (has_p || n == 0)
+                if (n < 16)
+                    params[n++] = p;
+            if (c == 'm')
+                _Console_apply_sgr(attr, params, n);
+            return i;
+        }
     }
 
-    _Console_m_compile_shader(vert_shader,
-            _Console_vertex_source, GL_VERTEX_SHADER);
-    _Console_m_compile_shader(frag_shader,
-            _Console_frag_source, GL_FRAGMENT_SHADER);
-    shader_prog = glCreateProgram();
+    return len - 1;
+}
 
-    /* setup values so they can be used to in destroy function if needed */
-    tty->VAO = VAO;
-    tty->VBO = VBO;
-    tty->shader_prog = shader_prog;
-    tty->vert_shader = vert_shader;
-    tty->frag_shader = frag_shader;
-    tty->window      = window;
+/*
+ * Find the first `n' bytes long `needle' in `len' bytes of `hay'. With SSE2
+ * 16 positions are tested at once by comparing the needle's first and last
+ * bytes, and only where both match is the rest compared.
+ * Returns the match or NULL.
+ */
+const char*
+_Console_find (const char *hay, size_t len, const char *needle, size_t n)
+{
+    const char *p, *end;
+    size_t i = 0;
 
-    /* actually link shaders */
-    glAttachShader(shader_prog, vert_shader);
-    glAttachShader(shader_prog, frag_shader);
-    glBindFragDataLocation(shader_prog, 0, "outColor");
-    glLinkProgram(shader_prog);
+    if (n == 0 || n > len)
+        return NULL;
+    if (n == 1)
+        return memchr(hay, needle[0], len);
 
-    /* and check status of link */
-    glGetProgramiv(shader_prog, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE) {
-        glGetProgramiv(shader_prog, GL_INFO_LOG_LENGTH, &maxlength);
-        if (maxlength > 0) {
-            char buffer[maxlength];
-            glGetProgramInfoLog(shader_prog, maxlength, NULL, buffer);
-            Console_SetError("OpenGL shader failed to link: ", buffer);
-            _Console_destroy_gl(tty);
-            return 1;
+#ifdef __SSE2__
+    {
+        __m128i first = _mm_set1_epi8(needle[0]);
+        __m128i last = _mm_set1_epi8(needle[n - 1]);
+        __m128i a, b;
+        unsigned mask;
+
+        for (; i + n - 1 + 16 <= len; i += 16) {
+            a = _mm_loadu_si128((const __m128i*)(hay + i));
+            b = _mm_loadu_si128((const __m128i*)(hay + i + n - 1));
+            mask = _mm_movemask_epi8(_mm_and_si128(
+                        _mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+            while (mask) {
+                int bit = __builtin_ctz(mask);
+                if (memcmp(hay + i + bit + 1, needle + 1, n - 2) == 0)
+                    return hay + i + bit;
+                mask &= mask - 1;
+            }
         }
     }
+#endif
+
+    /* what's left, or everything without SSE2 */
+    end = hay + len - n + 1;
+    for (p = hay + i; p < end; p++) {
+        p = memchr(p, needle[0], end - p);
+        if (!p)
+            return NULL;
+        if (memcmp(p + 1, needle + 1, n - 1) == 0)
+            return p;
+    }
+    return NULL;
+}
 
-    glUseProgram(tty->shader_prog);
+/*
+ * Whether `l' is shown: every line is unless filtering, when only the lines
+ * whose input or output has the filter in them are. Lines are searched once
+ * per filter.
+ */
+bool
+_Console_line_visible (Console_tty *tty, Console_Line *l)
+{
+    Console_Line *f = tty->filter_line;
+
+    if (!f || l == tty->lines_head)
+        return true;
+    if (l->match_gen != tty->filter_gen) {
+        l->match = f->len == 0 ||
+            _Console_find(l->input, l->len, f->input, f->len) ||
+            (l->output && _Console_find(l->output, l->output_len,
+                                        f->input, f->len));
+        l->match_gen = tty->filter_gen;
+    }
+    return l->match;
+}
 
-    /* Setup the buffer and attribute buffers so we can set values */
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+/*
+ * Calls `func' with every character of the line. Lines are laid out as the
+ * prompt and input followed by the output, if any, on a row of its own, and
+ * each piece is read where it is. Text is UTF-8, every codepoint takes up one
+ * column and rows wrap every wrap_len characters. The callback gets each
+ * character's row, column and colors; newlines and escape sequences are never
+ * passed and `func' may be NULL to just count rows.
+ * Returns the number of rows the line takes up.
+ */
+typedef void (*Console_LayoutFunc) (Console_tty *tty, 
+        int row, int col, Uint32 c, Console_Attr attr, void *data);
 
-    /* reserve size of buffer (one texture at a time) */
-    glBufferData(GL_ARRAY_BUFFER, 
-            sizeof(GLfloat) * 6 * 4, NULL, GL_DYNAMIC_DRAW);
+int
+_Console_layout_line (
+        Console_tty *tty, 
+        Console_Line *line, 
+        Console_LayoutFunc func,
+        void *data)
+{
+    Console_Attr attr = { 0, 0, false };
+    int row = 0;
+    int col = 0;
+    int i, start, len, n = 0, k;
+    const char *str, *m;
+    Uint32 c;
+    /* the repeat count is shown after the text in the default colors */
+    char repeat[32];
+    struct { const char *str; int len; } pieces[5];
+    /* matches of the filter in the input and output are highlighted */
+    Console_Line *f = tty->filter_line;
+    bool highlight = f && f->len > 0 && line != f;
+    int match_start, match_end;
+    /* only layouts that draw are timed, counting rows is too frequent */
+    Uint64 t0 = func ? CONSOLE_STAT_NOW() : 0;
+
+    if (!line->output_only) {
+        pieces[n].str = line == f ? CONSOLE_FILTER_PROMPT : tty->prompt;
+        pieces[n++].len = tty->prompt_len;
+        pieces[n].str = line->input;
+        pieces[n++].len = line->len;
+    }
+    /* a newline sentinel and then the output */
+    if (line->output && !line->output_only) {
+        pieces[n].str = "\n";
+        pieces[n++].len = 1;
+    }
+    if (line->output) {
+        pieces[n].str = line->output;
+        pieces[n++].len = line->output_len;
+    }
+    if (line->repeat > 1) {
+        pieces[n].str = repeat;
+        pieces[n++].len = snprintf(repeat, sizeof(repeat), "\033[0m (x%d)",
+                line->repeat);
+    }
 
-    /* set the offset of the position in the buffer */
-    posAttrib = glGetAttribLocation(shader_prog, "vertex");
-    glVertexAttribPointer(posAttrib, 4, GL_FLOAT, GL_FALSE, 
-            4 * sizeof(GLfloat), 0);
+    for (k = 0; k < n; k++) {
+        str = pieces[k].str;
+        len = pieces[k].len;
+        i = 0;
+        match_start = match_end = 0;
+        if (!highlight || (str != line->input && str != line->output))
+            match_start = match_end = len;
+        while (i < len) {
+            if (i >= match_end) {
+                m = _Console_find(str + i, len - i, f->input, f->len);
+                match_start = m ? m - str : len;
+                match_end = m ? match_start + f->len : len;
+            }
+            start = i;
 
-    glEnableVertexAttribArray(posAttrib);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+            /* most text is ASCII so skip decoding it */
+            c = (unsigned char)str[i];
+            if (c < 0x80)
+                i++;
+            else
+                c = _Console_utf8_decode(str, len, &i);
 
-    /* Set color for fragment shader */
-    glUniform3f(glGetUniformLocation(shader_prog, "textColor"),
-            1.0f, 1.0f, 1.0f);
+            if (c == '\033') {
+                i = _Console_parse_escape(str, len, i - 1, &attr) + 1;
+                continue;
+            }
+            if (col + 1 > tty->wrap_len || c == '\n') {
+                row++;
+                col = 0;
+                if (c == '\n')
+                    continue;
+            }
+            if (func)
+                func(tty, row, col, c, start >= match_start ?
+                        CONSOLE_MATCH_ATTR : attr, data);
+            col++;
+        }
+    }
 
-    if (SDL_GL_SetSwapInterval(1) < 0)
-        fprintf(stderr, "Warning: SwapInterval could not be set: %s\n", 
-                SDL_GetError());
+    if (func)
+        CONSOLE_STAT_SINCE(tty, layout_time, t0);
+    return row + 1;
+}
 
-    return 0;
+/*
+ * The number of rows a line takes up on screen.
+ */
+int
+_Console_line_rows (Console_tty *tty, Console_Line *line)
+{
+    return _Console_layout_line(tty, line, NULL, NULL);
 }
 
 /*
- * Create a 1x1 texture which is used for its transparency value
+ * Record that the character at row, col has the colors `attr'. Runs of the
+ * same colors on a row are merged into one span.
  */
 void
-_Console_create_trans_texture (
-        Console_tty *tty, 
-        GLuint *texture,
-        unsigned char transparency)
+_Console_line_add_span (Console_Line *line, int row, int col, Console_Attr attr)
 {
-    assert(tty);
-    /* figure out the dimensions of the cursor and create pixel */
-    unsigned char pixel[1] = { transparency };
-    /* Generate the texture */
-    glGenTextures(1, texture);
-    glBindTexture(GL_TEXTURE_2D, *texture);
-    glTexImage2D(
-            GL_TEXTURE_2D, 0, GL_RED, 1, 1, 0, GL_RED, GL_UNSIGNED_BYTE, 0);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    Console_Span *sp;
+
+    if (attr.fg == 0 && attr.bg == 0)
+        return;
+
+    sp = line->num_spans > 0 ? &line->spans[line->num_spans - 1] : NULL;
+    if (sp && sp->row == row && sp->col + sp->len == col &&
+            sp->attr.fg == attr.fg && sp->attr.bg == attr.bg) {
+        sp->len++;
+        return;
+    }
+
+    if (_Console_grow_array((void**)&line->spans, &line->max_spans,
+                line->num_spans + 1, sizeof(*line->spans)))
+        return;
+    line->spans[line->num_spans++] = (Console_Span) { row, col, 1, attr };
+}
+
+/* Where _Console_glyph_to_texture draws */
+typedef struct _Console_Raster {
+    Console_Line *line;
+    unsigned char *pixels;
+    int w;
+    int h;
+} Console_Raster;
+
+/*
+ * Layout callback which copies a character's glyph into the line's pixels.
+ * Glyphs are clipped to the texture and may overlap their neighbours, so they
+ * are combined by keeping the brighter pixel.
+ */
+void
+_Console_glyph_to_texture (Console_tty *tty, 
+        int row, int col, Uint32 c, Console_Attr attr, void *data)
+{
+    Console_Raster *r = data;
+    Console_Font *font = tty->font;
+    Console_Glyph *g;
+    int x0, y0, x, y;
+
+    _Console_line_add_span(r->line, row, col, attr);
+
+    if (c == ' ' || (g = _Console_get_glyph(font, c)) == NULL || !g->bitmap)
+        return;
+
+    /*
+     * Every character has a different bearing. To account for that we use
+     * the current line (y) and add in the line height as a buffer. In that
+     * buffer can each character be placed at different y values so they
+     * all appear in the same baseline.
+     */
+    x0 = col * font->char_width;
+    y0 = row * font->line_height + 
+         font->line_height - g->top - font->baseline - 1;
+
+    for (y = 0; y < g->rows; y++) {
+        if (y0 + y < 0 || y0 + y >= r->h)
+            continue;
+        unsigned char *dst = r->pixels + (y0 + y) * r->w + x0;
+        const unsigned char *src = g->bitmap + y * g->width;
+        for (x = 0; x < g->width && x0 + x < r->w; x++)
+            if (src[x] > dst[x])
+                dst[x] = src[x];
+    }
+}
+
+/*
+ * The GPU memory the console has, estimated from the sizes it asked for:
+ * textures are the line textures and the grid's atlas, buffers are the vertex
+ * buffer and the grid's cells.
+ */
+void
+_Console_gpu_usage (Console_tty *tty, size_t *textures, size_t *buffers)
+{
+    Console_Grid *grid = &tty->grid;
+    *textures = tty->texture_bytes;
+    *buffers = tty->batch.vbo_size;
+    if (grid->program != 0) {
+        *textures += (size_t)CONSOLE_ATLAS_COLS * tty->font->char_width *
+                     grid->atlas_rows * tty->font->line_height;
+        *buffers += (size_t)grid->cols * grid->rows * CONSOLE_CELL_BYTES;
+    }
+}
+
+size_t
+_Console_gpu_bytes (Console_tty *tty)
+{
+    size_t textures, buffers;
+    _Console_gpu_usage(tty, &textures, &buffers);
+    return textures + buffers;
+}
+
+/*
+ * Give `line' a texture of `w' by `h', reusing a pooled texture of that size
+ * if there is one. Has to be called within _Console_gl_begin/end.
+ * Returns true if the texture's storage still has to be allocated.
+ */
+bool
+_Console_take_texture (Console_tty *tty, Console_Line *line, int w, int h)
+{
+    int i;
+
+    line->tex_w = w;
+    line->tex_h = h;
+    for (i = 0; i < tty->pool_len; i++) {
+        if (tty->pool[i].w == w && tty->pool[i].h == h) {
+            line->texture = tty->pool[i].texture;
+            tty->pool[i] = tty->pool[--tty->pool_len];
+            return false;
+        }
+    }
+
+    /* texture parameters are per texture so only need setting once */
+    glGenTextures(1, &line->texture);
+    _Console_gl_bind_texture(tty, line->texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    /* fill it with the pixel */
-    glTexSubImage2D(
-            GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RED, GL_UNSIGNED_BYTE, pixel);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    tty->texture_bytes += (size_t)w * h;
+    return true;
 }
 
 /*
- * Inserts string `c' into the given text array. This will increase the text's
- * length by then of `c'.
- * Returns 1 if inserting will be past max, else inserts char and returns 0.
- * Expects len to be zero-indexed length of text array.
+ * Delete the texture of `line', keeping its text to be rasterized again.
  */
-int
-_Console_insert_text (char *text, const char *c, int index, int max, int *len)
+void
+_Console_evict_texture (Console_tty *tty, Console_Line *line)
 {
-    int c_len = strlen(c);
-    int i;
-    if (*len + c_len > max)
-        return 1;
-    for (i = *len; i >= index; i--)
-        text[i + c_len] = text[i];
-    for (i = 0; i < c_len; i++)
-        text[index + i] = c[i];
-    *len += c_len;
-    return 0;
+    if (line->texture == 0)
+        return;
+    _Console_gl_delete_texture(tty, &line->texture);
+    tty->texture_bytes -= (size_t)line->tex_w * line->tex_h;
 }
 
 /*
- * Handle inserting input depending on where the cursor is within the current
- * line.
+ * Put the texture of `line' in the pool, or delete it if the pool is full.
  */
 void
-_Console_get_input (Console_tty *tty, const char *input)
+_Console_release_texture (Console_tty *tty, Console_Line *line)
 {
-    assert(tty);
-    assert(input);
+    if (line->texture == 0)
+        return;
+    if (tty->pool_len == CONSOLE_POOL_MAX) {
+        _Console_evict_texture(tty, line);
+        return;
+    }
+    tty->pool[tty->pool_len].texture = line->texture;
+    tty->pool[tty->pool_len].w = line->tex_w;
+    tty->pool[tty->pool_len].h = line->tex_h;
+    tty->pool_len++;
+    line->texture = 0;
+}
 
-    int input_length = strlen(input);
-    if (tty->curr_line->len + input_length >= tty->max_input)
+/*
+ * Delete the pooled textures.
+ */
+void
+_Console_clear_pool (Console_tty *tty)
+{
+    while (tty->pool_len > 0) {
+        tty->pool_len--;
+        _Console_gl_delete_texture(tty, &tty->pool[tty->pool_len].texture);
+        tty->texture_bytes -= (size_t)tty->pool[tty->pool_len].w *
+                              tty->pool[tty->pool_len].h;
+    }
+}
+
+/*
+ * Delete every line texture, e.g. when their sizes change. Lines are
+ * rasterized again as they're drawn.
+ */
+void
+_Console_evict_all_textures (Console_tty *tty)
+{
+    Console_Line *l;
+    _Console_clear_pool(tty);
+    for (l = tty->lines_head; l != NULL; l = l->next)
+        _Console_evict_texture(tty, l);
+}
+
+/*
+ * Get back under the GPU memory budget: first the pool goes, then the
+ * textures of lines above the top of the window, oldest first.
+ */
+void
+_Console_trim_textures (Console_tty *tty)
+{
+    Console_Line *l, *hidden;
+    GLfloat ypos = -tty->scroll * tty->font->line_height;
+
+    if (tty->gpu_budget == 0 || _Console_gpu_bytes(tty) <= tty->gpu_budget)
         return;
 
-    /* if cursor is at end of line, it's a simple concatenation */
-    if (tty->cursor == tty->curr_line->len) {
-        strncat(tty->curr_line->input, input, input_length);
-        tty->curr_line->len += input_length;
-    } else {
-    /* else insert text into line at cursor's index */
-        _Console_insert_text(tty->curr_line->input, input, tty->cursor,
-                tty->max_input, &tty->curr_line->len);
+    _Console_clear_pool(tty);
+
+    /* find the first line that isn't drawn */
+    for (hidden = tty->lines_head; hidden && ypos < tty->window_height;
+            hidden = hidden->next)
+        if (_Console_line_visible(tty, hidden))
+            ypos += hidden->h;
+    if (!hidden)
+        return;
+
+    for (l = tty->lines_tail; l != NULL; l = l->prev) {
+        if (_Console_gpu_bytes(tty) <= tty->gpu_budget)
+            break;
+        _Console_evict_texture(tty, l);
+        if (l == hidden)
+            break;
     }
-    tty->cursor += input_length;
-    tty->rebuild_line = true;
 }
 
-/* 
- * Shifts a text left, removing a single character from the text array. Text
- * array must have a length greater than 0. This will decrement the length of
- * the array by 1.
+/*
+ * Updates the texture given with the input and prompt and also the output, if
+ * not null. This *will* changed the values w & h with the width and height of
+ * the texture as the input, prompt, and output change lengths to vary the size
+ * of the texture. The glyphs are drawn into memory first so the texture is
+ * uploaded in one call.
  */
 int
-_Console_shift_text (char *text, int index, int *len)
+_Console_update_line_texture (
+        Console_tty *tty,
+        Console_Line *line,
+        Console_Line *texture_line)
 {
-    int i;
-    if (*len <= 0)
+    assert(tty);
+    assert(line);
+    assert(texture_line);
+
+    Console_Font *font = tty->font;
+    Console_Raster r;
+    bool alloc = false;
+    Uint64 trace;
+
+    /* everything is rasterized once GL is set up */
+    if (!tty->gl_ready)
+        return 0;
+
+    /* while running a file of commands lines are rasterized when drawn */
+    if (tty->exec_depth > 0) {
+        _Console_gl_begin(tty);
+        _Console_release_texture(tty, texture_line);
+        _Console_gl_end(tty);
+        return 0;
+    }
+    trace = _Console_trace_begin(tty);
+
+    /* the size and colors belong to the line the texture is drawn for */
+    texture_line->w = tty->wrap_len * font->char_width;
+    texture_line->h = _Console_line_rows(tty, line) * font->line_height;
+    texture_line->num_spans = 0;
+
+    r.line = texture_line;
+    r.w = texture_line->w;
+    r.h = texture_line->h;
+    r.pixels = calloc(r.w * r.h, 1);
+    if (!r.pixels) {
+        Console_SetError("Not enough memory to draw line!", "");
         return 1;
-    for (i = index; i < *len - 1; i++)
-        text[i] = text[i + 1];
-    *len -= 1;
+    }
+
+    _Console_layout_line(tty, line, _Console_glyph_to_texture, &r);
+
+    /* storage is only allocated when the line changes height */
+    _Console_gl_begin(tty);
+    if (texture_line->texture != 0 &&
+            (texture_line->tex_w != r.w || texture_line->tex_h != r.h))
+        _Console_release_texture(tty, texture_line);
+    if (texture_line->texture == 0)
+        alloc = _Console_take_texture(tty, texture_line, r.w, r.h);
+
+    _Console_gl_bind_texture(tty, texture_line->texture);
+    _Console_gl_set(tty, CONSOLE_GL_UNPACK_ALIGNMENT, 1);
+    if (alloc)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RED,
+                r.w, r.h, 0, GL_RED, GL_UNSIGNED_BYTE, r.pixels);
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+                r.w, r.h, GL_RED, GL_UNSIGNED_BYTE, r.pixels);
+    CONSOLE_STAT_ADD(tty, texture_uploads, 1);
+    CONSOLE_STAT_ADD(tty, texture_bytes, r.w * r.h);
+    CONSOLE_STAT_ADD(tty, lines_rebuilt, 1);
+    _Console_trim_textures(tty);
+    _Console_gl_end(tty);
+
+    free(r.pixels);
+    _Console_trace_end(tty, "_Console_update_line_texture", trace);
     return 0;
 }
 
+int
+_Console_render_background (Console_tty *tty)
+{
+    return _Console_batch_quad(&tty->batch, 0, 0.0f, 0.0f,
+            tty->window_width, tty->window_height, 0.0f, 0.0f, 1.0f, 1.0f,
+            tty->bg_color, CONSOLE_QUAD_SOLID);
+}
+
+int
+_Console_render_cursor (Console_tty *tty)
+{
+    /* cursor's position in characters */
+    int cursor_len  = tty->prompt_len + 
+        _Console_utf8_len(tty->curr_line->input, tty->cursor);
+    GLfloat lh = tty->font->line_height;
+    GLfloat cw = tty->font->char_width;
+    /* the cursor's length within the line wrapped by max line characters */
+    GLfloat cx = (float)((cursor_len % tty->wrap_len) * tty->font->char_width);
+    /* The number of total lines minus the lines of cursor times line height */
+    GLfloat cy = ((tty->lines_head->h / lh) - 
+                 (float)((cursor_len / tty->wrap_len) + 1 + tty->scroll)) * lh;
+    /* the cursor is the font color at 75% opacity */
+    Console_Color c = tty->font_color;
+    c.a *= 0.75f;
+    return _Console_batch_quad(&tty->batch, 0, cx, cy, cw, lh,
+            0.0f, 0.0f, 1.0f, 1.0f, c, CONSOLE_QUAD_SOLID);
+}
+
 /*
- * Handle removing input with backspace or delete. We currenty only remove 
- * input one character at a time, unlike inserting input.
+ * Add a quad showing `rows' rows and `cols' columns of a line's texture,
+ * starting at `row' and `col', in the color `c'. The line's bottom is at
+ * `ypos'.
  */
-void
-_Console_remove_input (Console_tty *tty)
+int
+_Console_render_line_part (Console_tty *tty, Console_Line *l, GLfloat ypos,
+        int row, int col, int rows, int cols, Console_Color c)
 {
-    assert(tty);
-    if (tty->cursor == 0 || tty->curr_line->len == 0)
-        return;
+    GLfloat cw = tty->font->char_width;
+    GLfloat lh = tty->font->line_height;
+    GLfloat x = col * cw;
+    GLfloat y = ypos + l->h - (row + rows) * lh;
+    GLfloat w = cols * cw;
+    GLfloat h = rows * lh;
+
+    return _Console_batch_quad(&tty->batch, l->texture, x, y, w, h,
+            x / l->w, (row * lh) / l->h, (x + w) / l->w, 
+            ((row + rows) * lh) / l->h, c, CONSOLE_QUAD_TEXT);
+}
 
-    /* if cursor is at end of line just mark end of line at cursor */
-    if (tty->curr_line->len == tty->cursor) {
-        tty->curr_line->len -= 1;
-        tty->cursor -= 1;
-        tty->curr_line->input[tty->cursor] = '\0';
-    } else {
-    /* else shift the text from cursor left by one character */
-        tty->cursor -= 1;
-        _Console_shift_text(tty->curr_line->input, tty->cursor,
-                &tty->curr_line->len);
+/*
+ * Draw a line with colored spans. Backgrounds come first, then rows without
+ * any color are drawn together and the rest are cut into pieces around the
+ * spans. It all stays in the same draw as it's one texture.
+ */
+int
+_Console_render_line_spans (Console_tty *tty, Console_Line *l, GLfloat ypos)
+{
+    GLfloat cw = tty->font->char_width;
+    GLfloat lh = tty->font->line_height;
+    int rows = l->h / lh;
+    int plain = 0; /* first row of the current run of rows without spans */
+    int row, col, i;
+    Console_Span *sp;
+
+    for (i = 0; i < l->num_spans; i++) {
+        sp = &l->spans[i];
+        if (sp->attr.bg == 0)
+            continue;
+        if (_Console_batch_quad(&tty->batch, 0, sp->col * cw, 
+                    ypos + l->h - (sp->row + 1) * lh, sp->len * cw, lh,
+                    0.0f, 0.0f, 1.0f, 1.0f, _Console_palette[sp->attr.bg - 1],
+                    CONSOLE_QUAD_SOLID))
+            return 1;
     }
-    tty->rebuild_line = true;
+
+    for (i = 0; i < l->num_spans; ) {
+        row = l->spans[i].row;
+        if (row > plain && _Console_render_line_part(tty, l, ypos, 
+                    plain, 0, row - plain, tty->wrap_len, tty->font_color))
+            return 1;
+
+        for (col = 0; i < l->num_spans && l->spans[i].row == row; i++) {
+            sp = &l->spans[i];
+            Console_Color c = sp->attr.fg == 0 ? tty->font_color : 
+                                _Console_palette[sp->attr.fg - 1];
+            if (sp->col > col && _Console_render_line_part(tty, l, ypos, 
+                        row, col, 1, sp->col - col, tty->font_color))
+                return 1;
+            if (_Console_render_line_part(tty, l, ypos, 
+                        row, sp->col, 1, sp->len, c))
+                return 1;
+            col = sp->col + sp->len;
+        }
+
+        if (col < tty->wrap_len && _Console_render_line_part(tty, l, ypos, 
+                    row, col, 1, tty->wrap_len - col, tty->font_color))
+            return 1;
+        plain = row + 1;
+    }
+
+    if (plain < rows)
+        return _Console_render_line_part(tty, l, ypos, 
+                plain, 0, rows - plain, tty->wrap_len, tty->font_color);
+    return 0;
+}
+
+/*
+ * Lines are drawn from the bottom of the window up, less the rows scrolled,
+ * stopping at the first line that is entirely off the top of the window.
+ * Lines without a texture are rasterized as they come on screen.
+ */
+int
+_Console_render_lines (Console_tty *tty)
+{
+    Console_Line *l, *src;
+    GLfloat ypos = -tty->scroll * tty->font->line_height;
+    GLfloat h;
+    for (l = tty->lines_head; l && ypos < tty->window_height; l = l->next) {
+        if (!_Console_line_visible(tty, l))
+            continue;
+        src = l == tty->lines_head ? tty->curr_line : l;
+        /* lines below the bottom are skipped without rasterizing them */
+        h = l->texture ? l->h :
+            _Console_line_rows(tty, src) * tty->font->line_height;
+        if (ypos + h <= 0.0f) {
+            ypos += h;
+            continue;
+        }
+        if (l->texture == 0 && _Console_update_line_texture(tty, src, l))
+            return 1;
+        if (l->num_spans > 0) {
+            if (_Console_render_line_spans(tty, l, ypos))
+                return 1;
+        } else if (_Console_batch_quad(&tty->batch, l->texture, 0.0f, ypos, 
+                    l->w, l->h, 0.0f, 0.0f, 1.0f, 1.0f,
+                    tty->font_color, CONSOLE_QUAD_TEXT)) {
+            return 1;
+        }
+        ypos += l->h;
+    }
+    return 0;
+}
+
+#define _Console_m_compile_shader(s,src,t) \
+    s = glCreateShader(t); \
+    glShaderSource(s, 1, &src, NULL); \
+    glCompileShader(s); \
+    glGetShaderiv(s, GL_COMPILE_STATUS, &status); \
+    if (status != GL_TRUE) { \
+        char buffer[512]; \
+        glGetShaderInfoLog(s, 512, NULL, buffer); \
+        Console_SetError("Shader failed to compile: ", buffer); \
+        goto fail; \
+    }
+
+#define CONSOLE_HASH_INIT 14695981039346656037ULL
+
+/*
+ * FNV-1a hash of `len' bytes, continuing from `hash'.
+ */
+Uint64
+_Console_hash_bytes (Uint64 hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Linked programs are kept in the cache directory as program binaries so
+ * later runs don't compile the shaders. A binary only suits the driver that
+ * made it so the file is keyed by the driver's strings and the sources.
+ * The header is followed by `length' bytes of the binary.
+ */
+#define CONSOLE_PROGRAM_MAGIC "SDLCONP"
+
+typedef struct _Console_ProgramHeader {
+    char magic[8];
+    Uint32 version;
+    Uint32 format;
+    Uint32 length;
+} Console_ProgramHeader;
+
+/*
+ * Copy the directory of the cache files, which another thread may change.
+ * Returns NULL if they aren't used or out of memory.
+ */
+char*
+_Console_copy_cache_path (void)
+{
+    char *path = NULL;
+
+    SDL_AtomicLock(&_Console_cache_lock);
+    if (_Console_cache_path)
+        path = strdup(_Console_cache_path);
+    SDL_AtomicUnlock(&_Console_cache_lock);
+    return path;
+}
+
+/*
+ * Get the cache file in `dir' of the program built from `vert' and `frag'.
+ * Returns false if program binaries aren't cached.
+ */
+bool
+_Console_program_cache_file (const char *dir, const GLchar *vert,
+        const GLchar *frag, char *buf, size_t len)
+{
+    const char *strs[5];
+    Uint64 hash = CONSOLE_HASH_INIT;
+    int i;
+
+    if (!dir || !SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))
+        return false;
+
+    strs[0] = vert;
+    strs[1] = frag;
+    strs[2] = (const char*)glGetString(GL_VENDOR);
+    strs[3] = (const char*)glGetString(GL_RENDERER);
+    strs[4] = (const char*)glGetString(GL_VERSION);
+    for (i = 0; i < 5; i++) {
+        if (!strs[i])
+            return false;
+        hash = _Console_hash_bytes(hash, strs[i], strlen(strs[i]) + 1);
+    }
+
+    snprintf(buf, len, "%s/program-%016llx.bin", dir,
+            (unsigned long long)hash);
+    return true;
+}
+
+/*
+ * Link `prog' from the binary in the cache file at `path'.
+ * Returns 1 if there's no file or the driver won't take it, 0 otherwise.
+ */
+int
+_Console_load_program_binary (GLuint prog, const char *path)
+{
+    const Console_ProgramHeader *h;
+    struct stat st;
+    void *map;
+    GLint status = GL_FALSE;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*h)) {
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    h = map;
+    if (memcmp(h->magic, CONSOLE_PROGRAM_MAGIC, sizeof(h->magic)) == 0 &&
+        h->version == CONSOLE_CACHE_VERSION &&
+        h->length <= st.st_size - sizeof(*h)) {
+        glProgramBinary(prog, h->format, h + 1, h->length);
+        glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    }
+
+    munmap(map, st.st_size);
+    return status != GL_TRUE;
+}
+
+/*
+ * Write the binary of the linked program `prog' to the cache file at `path'
+ * in `dir'.
+ */
+void
+_Console_save_program_binary (GLuint prog, const char *dir, const char *path)
+{
+    Console_ProgramHeader h;
+    char tmp[4096 + 32];
+    GLint length = 0;
+    GLenum format;
+    void *data;
+    FILE *f;
+
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || !(data = malloc(length)))
+        return;
+    glGetProgramBinary(prog, length, NULL, &format, data);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CONSOLE_PROGRAM_MAGIC, sizeof(h.magic));
+    h.version = CONSOLE_CACHE_VERSION;
+    h.format = format;
+    h.length = length;
+
+    mkdir(dir, 0755);
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+    f = fopen(tmp, "wb");
+    if (f) {
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(data, length, 1, f);
+        if ((ferror(f) | fclose(f)) != 0 || rename(tmp, path) != 0) {
+            remove(tmp);
+            f = NULL;
+        }
+    }
+    if (!f)
+        fprintf(stderr, "Warning: couldn't write program cache %s\n", path);
+    free(data);
+}
+
+/*
+ * Build a program from the shader sources `vert' and `frag', or from its
+ * binary if one was cached. The shaders are returned in `vs' and `fs' to be
+ * destroyed with the program and are 0 if the binary was used.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+_Console_build_program (const GLchar *vert, const GLchar *frag,
+        GLuint *prog, GLuint *vs, GLuint *fs)
+{
+    char path[4096];
+    char *dir = _Console_copy_cache_path();
+    bool cache = _Console_program_cache_file(dir, vert, frag, path,
+            sizeof(path));
+    GLint status;
+    GLint maxlength;
+
+    *vs = 0;
+    *fs = 0;
+    *prog = glCreateProgram();
+    if (cache && _Console_load_program_binary(*prog, path) == 0) {
+        free(dir);
+        return 0;
+    }
+
+    _Console_m_compile_shader(*vs, vert, GL_VERTEX_SHADER);
+    _Console_m_compile_shader(*fs, frag, GL_FRAGMENT_SHADER);
+
+    glAttachShader(*prog, *vs);
+    glAttachShader(*prog, *fs);
+    glBindFragDataLocation(*prog, 0, "outColor");
+    if (cache)
+        glProgramParameteri(*prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                GL_TRUE);
+    glLinkProgram(*prog);
+
+    glGetProgramiv(*prog, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        glGetProgramiv(*prog, GL_INFO_LOG_LENGTH, &maxlength);
+        char buffer[maxlength > 0 ? maxlength : 1];
+        buffer[0] = '\0';
+        glGetProgramInfoLog(*prog, maxlength, NULL, buffer);
+        Console_SetError("OpenGL shader failed to link: ", buffer);
+        goto fail;
+    }
+
+    if (cache)
+        _Console_save_program_binary(*prog, dir, path);
+    free(dir);
+    return 0;
+
+fail:
+    free(dir);
+    /* deleting 0 is ignored, so shaders not made yet are fine */
+    glDeleteShader(*vs);
+    glDeleteShader(*fs);
+    glDeleteProgram(*prog);
+    *vs = 0;
+    *fs = 0;
+    *prog = 0;
+    return 1;
+}
+
+void
+_Console_destroy_grid (Console_tty *tty)
+{
+    Console_Grid *grid = &tty->grid;
+    int i;
+    glDeleteTextures(1, &grid->atlas);
+    glDeleteTextures(1, &grid->cells_texture);
+    glDeleteBuffers(1, &grid->cells_buffer);
+    glDeleteVertexArrays(1, &grid->VAO);
+    glDeleteShader(grid->vert_shader);
+    glDeleteShader(grid->frag_shader);
+    glDeleteProgram(grid->program);
+    /* the names may be given out again, so bindings are looked at anew */
+    tty->gl_state.known = 0;
+    free(grid->cells);
+    /* the glyphs outlive the atlas */
+    for (i = 1; i < grid->num_slots; i++)
+        grid->slots[i]->slot = 0;
+    free(grid->slots);
+    *grid = (Console_Grid) { 0 };
+}
+
+/*
+ * Copy slot `slot' of the atlas up to the atlas texture, which has to be
+ * bound. Glyphs sit in their cells just as they do in line textures and are
+ * clipped to the cell.
+ */
+void
+_Console_grid_upload_slot (Console_tty *tty, int slot)
+{
+    Console_Font *font = tty->font;
+    Console_Glyph *g = tty->grid.slots[slot];
+    int cw = font->char_width;
+    int lh = font->line_height;
+    int ypos = lh - g->top - font->baseline - 1;
+    unsigned char pixels[cw * lh];
+    int x, y;
+
+    memset(pixels, 0, cw * lh);
+    for (y = 0; y < g->rows; y++) {
+        if (ypos + y < 0 || ypos + y >= lh)
+            continue;
+        for (x = 0; x < g->width; x++)
+            if (x + g->left >= 0 && x + g->left < cw)
+                pixels[(ypos + y) * cw + x + g->left] = 
+                    g->bitmap[y * g->width + x];
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 
+            (slot % CONSOLE_ATLAS_COLS) * cw, (slot / CONSOLE_ATLAS_COLS) * lh,
+            cw, lh, GL_RED, GL_UNSIGNED_BYTE, pixels);
+    CONSOLE_STAT_ADD(tty, texture_uploads, 1);
+    CONSOLE_STAT_ADD(tty, texture_bytes, cw * lh);
+}
+
+/*
+ * (Re)allocate the atlas texture with `rows' rows of cells and upload every
+ * glyph placed so far.
+ * Returns 1 if out of memory, 0 otherwise.
+ */
+int
+_Console_grid_alloc_atlas (Console_tty *tty, int rows)
+{
+    Console_Grid *grid = &tty->grid;
+    int w = CONSOLE_ATLAS_COLS * tty->font->char_width;
+    int h = rows * tty->font->line_height;
+    unsigned char *empty;
+    int i;
+
+    if (_Console_grow_array((void**)&grid->slots, &grid->max_slots,
+                rows * CONSOLE_ATLAS_COLS, sizeof(*grid->slots)))
+        return 1;
+
+    empty = calloc(w * h, 1);
+    if (!empty) {
+        Console_SetError("Not enough memory to create atlas!", "");
+        return 1;
+    }
+
+    _Console_gl_begin(tty);
+    _Console_gl_bind_texture(tty, grid->atlas);
+    _Console_gl_set(tty, CONSOLE_GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, 
+            GL_RED, GL_UNSIGNED_BYTE, empty);
+    CONSOLE_STAT_ADD(tty, texture_uploads, 1);
+    CONSOLE_STAT_ADD(tty, texture_bytes, w * h);
+    /* distance fields are scaled so they're filtered */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, 
+            tty->font->sdf ? GL_LINEAR : GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, 
+            tty->font->sdf ? GL_LINEAR : GL_NEAREST);
+    for (i = 1; i < grid->num_slots; i++)
+        _Console_grid_upload_slot(tty, i);
+    _Console_gl_end(tty);
+
+    free(empty);
+    grid->atlas_rows = rows;
+    return 0;
+}
+
+/*
+ * Get the atlas slot of codepoint `c', placing its glyph in the atlas the
+ * first time it's used. Glyphs without pixels, and any glyph once the atlas
+ * can't grow, use the blank slot 0.
+ */
+int
+_Console_grid_slot (Console_tty *tty, Uint32 c)
+{
+    Console_Grid *grid = &tty->grid;
+    Console_Glyph *g = _Console_get_glyph(tty->font, c);
+    int capacity = grid->atlas_rows * CONSOLE_ATLAS_COLS;
+
+    if (!g || !g->bitmap)
+        return 0;
+    if (g->slot != 0)
+        return g->slot;
+
+    if (grid->num_slots == capacity) {
+        if (capacity * 2 > CONSOLE_ATLAS_MAX ||
+            _Console_grid_alloc_atlas(tty, grid->atlas_rows * 2))
+            return 0;
+    }
+
+    g->slot = grid->num_slots++;
+    grid->slots[g->slot] = g;
+
+    _Console_gl_begin(tty);
+    _Console_gl_bind_texture(tty, grid->atlas);
+    _Console_gl_set(tty, CONSOLE_GL_UNPACK_ALIGNMENT, 1);
+    _Console_grid_upload_slot(tty, g->slot);
+    _Console_gl_end(tty);
+
+    return g->slot;
+}
+
+/*
+ * Create the atlas with the printable ASCII characters already placed.
+ * Returns 1 if out of memory, 0 otherwise.
+ */
+int
+_Console_grid_build_atlas (Console_tty *tty)
+{
+    Console_Grid *grid = &tty->grid;
+    Uint32 c;
+
+    /* slot 0 stays blank */
+    grid->num_slots = 1;
+    if (_Console_grid_alloc_atlas(tty, CONSOLE_ATLAS_ROWS))
+        return 1;
+    for (c = '!'; c <= '~'; c++)
+        _Console_grid_slot(tty, c);
+    return 0;
+}
+
+/*
+ * Start the atlas over, e.g. for a new font.
+ * Returns 1 if out of memory, 0 otherwise.
+ */
+int
+_Console_grid_reset_atlas (Console_tty *tty)
+{
+    Console_Grid *grid = &tty->grid;
+    int i;
+    for (i = 1; i < grid->num_slots; i++)
+        grid->slots[i]->slot = 0;
+    return _Console_grid_build_atlas(tty);
+}
+
+/*
+ * Compile the grid's shaders and create its atlas and buffers. The cells
+ * themselves are sized by _Console_grid_resize.
+ */
+int
+_Console_init_grid (Console_tty *tty)
+{
+    Console_Grid *grid = &tty->grid;
+
+    if (_Console_build_program(_Console_grid_vertex_source,
+                _Console_grid_frag_source, &grid->program,
+                &grid->vert_shader, &grid->frag_shader)) {
+        _Console_destroy_grid(tty);
+        return 1;
+    }
+
+    /* the vertex shader makes its own positions but core GL wants a VAO */
+    glGenVertexArrays(1, &grid->VAO);
+    glGenBuffers(1, &grid->cells_buffer);
+    glGenTextures(1, &grid->cells_texture);
+    glGenTextures(1, &grid->atlas);
+
+    glUseProgram(grid->program);
+    glUniform1i(glGetUniformLocation(grid->program, "atlas"), 0);
+    glUniform1i(glGetUniformLocation(grid->program, "cells"), 1);
+    glUniform1i(glGetUniformLocation(grid->program, "atlas_cols"), 
+            CONSOLE_ATLAS_COLS);
+    glUniform4fv(glGetUniformLocation(grid->program, "palette"), 16,
+            (const GLfloat*)_Console_palette);
+    grid->grid_loc = glGetUniformLocation(grid->program, "grid");
+    grid->cell_size_loc = glGetUniformLocation(grid->program, "cell_size");
+    grid->atlas_cell_loc = glGetUniformLocation(grid->program, "atlas_cell");
+    grid->sdf_loc = glGetUniformLocation(grid->program, "sdf");
+    grid->smoothing_loc = glGetUniformLocation(grid->program, "smoothing");
+    grid->cursor_loc = glGetUniformLocation(grid->program, "cursor");
+    grid->bg_color_loc = glGetUniformLocation(grid->program, "bg_color");
+    grid->fg_color_loc = glGetUniformLocation(grid->program, "fg_color");
+    grid->cursor_color_loc = 
+        glGetUniformLocation(grid->program, "cursor_color");
+    glUseProgram(0);
+
+    if (_Console_grid_build_atlas(tty)) {
+        _Console_destroy_grid(tty);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Size the cells to cover the window. Everything is laid out again on the
+ * next render.
+ */
+int
+_Console_grid_resize (Console_tty *tty)
+{
+    Console_Grid *grid = &tty->grid;
+    int rows = ceilf((float)tty->window_height / tty->cell_height);
+    size_t size = (size_t)tty->wrap_len * rows * CONSOLE_CELL_BYTES;
+    unsigned char *cells = realloc(grid->cells, size);
+
+    if (!cells) {
+        Console_SetError("Not enough memory to create grid!", "");
+        return 1;
+    }
+
+    grid->cells = cells;
+    grid->cols = tty->wrap_len;
+    grid->rows = rows;
+    grid->rebuild = true;
+
+    _Console_gl_begin(tty);
+    glBindBuffer(GL_TEXTURE_BUFFER, grid->cells_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    _Console_gl_bind_buffer_texture(tty, grid->cells_texture);
+    glActiveTexture(GL_TEXTURE1);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8UI, grid->cells_buffer);
+    glActiveTexture(GL_TEXTURE0);
+    _Console_gl_end(tty);
+
+    return 0;
+}
+
+/* Where in the grid a line's rows start and how many rows it has */
+typedef struct _Console_Grid_Place {
+    int bottom;
+    int rows;
+} Console_Grid_Place;
+
+/*
+ * Layout callback which puts a character's atlas slot into its cell.
+ */
+void
+_Console_glyph_to_cell (Console_tty *tty, 
+        int row, int col, Uint32 c, Console_Attr attr, void *data)
+{
+    Console_Grid *grid = &tty->grid;
+    Console_Grid_Place *place = data;
+    int grid_row = place->bottom + place->rows - 1 - row;
+    unsigned char *cell;
+    int slot;
+
+    if (grid_row < 0 || grid_row >= grid->rows || col >= grid->cols)
+        return;
+
+    cell = &grid->cells[(grid_row * grid->cols + col) * CONSOLE_CELL_BYTES];
+    slot = c == ' ' ? 0 : _Console_grid_slot(tty, c);
+    cell[0] = slot & 0xFF;
+    cell[1] = slot >> 8;
+    cell[2] = attr.fg;
+    cell[3] = attr.bg;
+}
+
+/*
+ * Lay out `line' into the grid with its last row at `bottom'.
+ */
+void
+_Console_grid_place_line (Console_tty *tty, Console_Line *line, int bottom,
+        int rows)
+{
+    Console_Grid_Place place = { bottom, rows };
+    _Console_layout_line(tty, line, _Console_glyph_to_cell, &place);
+    CONSOLE_STAT_ADD(tty, lines_rebuilt, 1);
+}
+
+/*
+ * Update the cells for the current frame. Only the rows of the line being
+ * edited are written again unless something moved the other lines.
+ */
+void
+_Console_grid_update (Console_tty *tty)
+{
+    Console_Grid *grid = &tty->grid;
+    size_t row_size = grid->cols * CONSOLE_CELL_BYTES;
+    int head_rows = _Console_line_rows(tty, tty->curr_line);
+    int bottom;
+    Console_Line *l;
+
+    if (!grid->rebuild && head_rows == grid->head_rows && tty->scroll == 0) {
+        /* the line being edited always sits at the bottom of the grid */
+        int rows = head_rows < grid->rows ? head_rows : grid->rows;
+        memset(grid->cells, 0, rows * row_size);
+        _Console_grid_place_line(tty, tty->curr_line, 0, head_rows);
+        glBindBuffer(GL_TEXTURE_BUFFER, grid->cells_buffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, rows * row_size, grid->cells);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        CONSOLE_STAT_ADD(tty, texture_uploads, 1);
+        CONSOLE_STAT_ADD(tty, texture_bytes, rows * row_size);
+        return;
+    }
+
+    /* rows scrolled off the bottom are below the grid */
+    memset(grid->cells, 0, grid->rows * row_size);
+    _Console_grid_place_line(tty, tty->curr_line, -tty->scroll, head_rows);
+    bottom = head_rows - tty->scroll;
+    for (l = tty->lines_head->next; l && bottom < grid->rows; l = l->next) {
+        int rows;
+        if (!_Console_line_visible(tty, l))
+            continue;
+        rows = _Console_line_rows(tty, l);
+        _Console_grid_place_line(tty, l, bottom, rows);
+        bottom += rows;
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, grid->cells_buffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, grid->rows * row_size, grid->cells);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    CONSOLE_STAT_ADD(tty, texture_uploads, 1);
+    CONSOLE_STAT_ADD(tty, texture_bytes, grid->rows * row_size);
+
+    grid->head_rows = head_rows;
+    grid->rebuild = false;
+}
+
+/*
+ * Draw the whole console with the grid renderer: one triangle, no vertex
+ * data and no texture switches.
+ */
+void
+_Console_grid_render (Console_tty *tty)
+{
+    Console_Grid *grid = &tty->grid;
+    int cursor_len = tty->prompt_len +
+        _Console_utf8_len(tty->curr_line->input, tty->cursor);
+    Console_Color cc = tty->font_color;
+    Console_Color bg = tty->bg_color;
+    Console_Color fg = tty->font_color;
+
+    if (tty->rebuild_line || grid->rebuild) {
+        tty->rebuild_line = false;
+        _Console_grid_update(tty);
+    }
+
+    cc.a *= 0.75f;
+
+    _Console_gl_set(tty, CONSOLE_GL_PROGRAM, grid->program);
+    _Console_gl_set(tty, CONSOLE_GL_VERTEX_ARRAY, grid->VAO);
+    _Console_gl_bind_buffer_texture(tty, grid->cells_texture);
+    _Console_gl_bind_texture(tty, grid->atlas);
+
+    glUniform2i(grid->grid_loc, grid->cols, grid->rows);
+    glUniform2f(grid->cell_size_loc, tty->cell_width, tty->cell_height);
+    glUniform2i(grid->atlas_cell_loc, 
+            tty->font->char_width, tty->font->line_height);
+    glUniform1i(grid->sdf_loc, tty->font->sdf);
+    glUniform1f(grid->smoothing_loc, 0.25f / (CONSOLE_SDF_SPREAD * 
+                tty->cell_width / tty->font->char_width));
+    glUniform2i(grid->cursor_loc, cursor_len % tty->wrap_len,
+            grid->head_rows - 1 - cursor_len / tty->wrap_len - tty->scroll);
+    glUniform4f(grid->bg_color_loc, bg.r, bg.g, bg.b, bg.a);
+    glUniform4f(grid->fg_color_loc, fg.r, fg.g, fg.b, fg.a);
+    glUniform4f(grid->cursor_color_loc, cc.r, cc.g, cc.b, cc.a);
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    CONSOLE_STAT_ADD(tty, draw_calls, 1);
+}
+
+/*
+ * Add a frame time to the ring.
+ */
+void
+_Console_record_frame_time (Console_tty *tty, float ms)
+{
+    tty->frame_times[tty->frame_time_next] = ms;
+    tty->frame_time_next = (tty->frame_time_next + 1) % CONSOLE_FRAME_TIMES;
+    if (tty->num_frame_times < CONSOLE_FRAME_TIMES)
+        tty->num_frame_times++;
+}
+
+/*
+ * The `i'th most recent frame time, counting from 0.
+ */
+float
+_Console_frame_time (Console_tty *tty, int i)
+{
+    return tty->frame_times[(tty->frame_time_next - 1 - i +
+            CONSOLE_FRAME_TIMES) % CONSOLE_FRAME_TIMES];
+}
+
+typedef void (*Console_RectFunc) (Console_tty *tty, int x, int y, int w,
+        int h, Console_Color c, void *data);
+
+/*
+ * Lay out the frame graph as rectangles, from the top of the window down:
+ * a backdrop, a bar for each recent frame and a line at 60 frames a second.
+ * Bars are green up to that, yellow up to twice that and red after, and the
+ * graph scales to fit the slowest frame shown.
+ */
+void
+_Console_graph_rects (Console_tty *tty, Console_RectFunc func, void *data)
+{
+    int n = tty->num_frame_times < CONSOLE_GRAPH_BARS ?
+            tty->num_frame_times : CONSOLE_GRAPH_BARS;
+    int x0 = tty->window_width - CONSOLE_GRAPH_BARS - CONSOLE_GRAPH_MARGIN;
+    int y0 = CONSOLE_GRAPH_MARGIN;
+    float top = 2.0f * CONSOLE_GRAPH_TARGET;
+    float ms;
+    int i, h;
+    Console_Color c;
+
+    for (i = 0; i < n; i++)
+        if (_Console_frame_time(tty, i) > top)
+            top = _Console_frame_time(tty, i);
+
+    func(tty, x0, y0, CONSOLE_GRAPH_BARS, CONSOLE_GRAPH_HEIGHT,
+            (Console_Color) { 0.0f, 0.0f, 0.0f, 0.6f }, data);
+
+    /* the newest frame is on the right */
+    for (i = 0; i < n; i++) {
+        ms = _Console_frame_time(tty, i);
+        h = ms / top * CONSOLE_GRAPH_HEIGHT + 0.5f;
+        if (h < 1)
+            h = 1;
+        if (ms <= CONSOLE_GRAPH_TARGET)
+            c = (Console_Color) { 0.3f, 0.9f, 0.3f, 0.9f };
+        else if (ms <= 2.0f * CONSOLE_GRAPH_TARGET)
+            c = (Console_Color) { 0.9f, 0.8f, 0.2f, 0.9f };
+        else
+            c = (Console_Color) { 0.9f, 0.2f, 0.2f, 0.9f };
+        func(tty, x0 + CONSOLE_GRAPH_BARS - 1 - i,
+                y0 + CONSOLE_GRAPH_HEIGHT - h, 1, h, c, data);
+    }
+
+    h = CONSOLE_GRAPH_TARGET / top * CONSOLE_GRAPH_HEIGHT + 0.5f;
+    func(tty, x0, y0 + CONSOLE_GRAPH_HEIGHT - h, CONSOLE_GRAPH_BARS, 1,
+            (Console_Color) { 1.0f, 1.0f, 1.0f, 0.5f }, data);
+}
+
+void
+_Console_rect_to_batch (Console_tty *tty, int x, int y, int w, int h,
+        Console_Color c, void *data)
+{
+    int *failed = data;
+
+    /* the batch counts up from the bottom of the window */
+    if (_Console_batch_quad(&tty->batch, 0, x, tty->window_height - y - h,
+                w, h, 0.0f, 0.0f, 1.0f, 1.0f, c, CONSOLE_QUAD_SOLID))
+        *failed = 1;
+}
+
+/*
+ * Add the frame graph to the batch if it's shown. It's all solid quads so it
+ * joins the batch's last draw.
+ * Returns 1 if out of memory, 0 otherwise.
+ */
+int
+_Console_render_graph (Console_tty *tty)
+{
+    int failed = 0;
+
+    if (tty->frame_graph)
+        _Console_graph_rects(tty, _Console_rect_to_batch, &failed);
+    return failed;
+}
+
+int
+Console_Render (Console_tty *tty)
+{
+    assert(tty);
+
+    int ret = 0;
+    Uint64 trace = _Console_trace_begin(tty);
+    int gpu_slot;
+
+    _Console_trace_init_gpu(tty);
+    gpu_slot = _Console_trace_gpu_begin(tty);
+    _Console_gl_begin(tty);
+
+    if (_Console_m_uses_grid(tty)) {
+        _Console_gl_set(tty, CONSOLE_GL_BLEND, GL_TRUE);
+        _Console_gl_set(tty, CONSOLE_GL_BLEND_FUNC, 1);
+        _Console_grid_render(tty);
+        if (!tty->frame_graph)
+            goto exit;
+        /* the graph is the one draw on top of the grid */
+        _Console_batch_reset(&tty->batch);
+        if (_Console_render_graph(tty)) {
+            ret = 1;
+            goto exit;
+        }
+        goto draw;
+    }
+
+    /* highlights moved, so lines are rasterized again as they're shown */
+    if (tty->filter_changed) {
+        tty->filter_changed = false;
+        _Console_evict_all_textures(tty);
+        tty->rebuild_line = true;
+    }
+
+    if (tty->rebuild_line) {
+        tty->rebuild_line = false;
+        if (_Console_update_line_texture(tty, tty->curr_line, tty->lines_head)) {
+            ret = 1;
+            goto exit;
+        }
+    }
+
+    /* 
+     * Collect the background, lines, cursor and frame graph into one batch.
+     * The background, cursor and graph don't need a texture so they share
+     * the draws of the first and last lines.
+     */
+    _Console_batch_reset(&tty->batch);
+    if (_Console_render_background(tty) || 
+        _Console_render_lines(tty) ||
+        _Console_render_cursor(tty) ||
+        _Console_render_graph(tty)) {
+        ret = 1;
+        goto exit;
+    }
+
+draw:
+    /* set all options, programs, and buffers to draw our batch */
+    _Console_gl_set(tty, CONSOLE_GL_CULL_FACE, GL_TRUE);
+    _Console_gl_set(tty, CONSOLE_GL_BLEND, GL_TRUE);
+    _Console_gl_set(tty, CONSOLE_GL_BLEND_FUNC, 1);
+    _Console_gl_set(tty, CONSOLE_GL_PROGRAM, tty->shader_prog);
+    _Console_gl_set(tty, CONSOLE_GL_VERTEX_ARRAY, tty->VAO);
+    _Console_gl_set(tty, CONSOLE_GL_ARRAY_BUFFER, tty->VBO);
+
+    _Console_batch_draw(tty, &tty->batch);
+
+exit:
+    /* unset only what we've set */
+    _Console_gl_end(tty);
+    _Console_trace_gpu_end(tty, gpu_slot);
+    _Console_trace_end(tty, "Console_Render", trace);
+    return ret;
+}
+
+/* Where _Console_glyph_to_frame draws a line */
+typedef struct _Console_Frame_Place {
+    int top;               /* row of the frame the line's first row is on */
+} Console_Frame_Place;
+
+/*
+ * Blend a rectangle of color `c' into the frame, with `coverage' giving
+ * each pixel's alpha if it isn't NULL.
+ */
+void
+_Console_frame_blend (Console_tty *tty, int x0, int y0, int w, int h,
+        Console_Color c, const unsigned char *coverage, int pitch)
+{
+    int x, y, i;
+    float a;
+    unsigned char *px;
+
+    for (y = 0; y < h; y++) {
+        if (y0 + y < 0 || y0 + y >= tty->window_height)
+            continue;
+        for (x = 0; x < w; x++) {
+            if (x0 + x < 0 || x0 + x >= tty->window_width)
+                continue;
+            a = c.a;
+            if (coverage)
+                a *= coverage[y * pitch + x] / 255.0f;
+            if (a <= 0.0f)
+                continue;
+            px = tty->frame + ((y0 + y) * tty->window_width + x0 + x) * 4;
+            for (i = 0; i < 3; i++)
+                px[i] = (&c.r)[i] * 255.0f * a + px[i] * (1.0f - a) + 0.5f;
+        }
+    }
+}
+
+/*
+ * Layout callback which draws a character with its colors into the frame.
+ */
+void
+_Console_glyph_to_frame (Console_tty *tty,
+        int row, int col, Uint32 c, Console_Attr attr, void *data)
+{
+    Console_Frame_Place *place = data;
+    Console_Font *font = tty->font;
+    Console_Color fg = attr.fg ? _Console_palette[attr.fg - 1] :
+                                 tty->font_color;
+    Console_Glyph *g;
+    int x0 = col * font->char_width;
+    int y0 = place->top + row * font->line_height;
+
+    if (attr.bg)
+        _Console_frame_blend(tty, x0, y0, font->char_width, font->line_height,
+                _Console_palette[attr.bg - 1], NULL, 0);
+
+    if (c == ' ' || (g = _Console_get_glyph(font, c)) == NULL || !g->bitmap)
+        return;
+
+    /* placed on the baseline the same way as in line textures */
+    _Console_frame_blend(tty, x0, y0 + font->line_height - g->top -
+            font->baseline - 1, g->width, g->rows, fg, g->bitmap, g->width);
+}
+
+void
+_Console_rect_to_frame (Console_tty *tty, int x, int y, int w, int h,
+        Console_Color c, void *data)
+{
+    _Console_frame_blend(tty, x, y, w, h, c, NULL, 0);
+}
+
+/*
+ * Draw the console in software into the frame of a headless console. The
+ * frame starts out black and everything is blended over it like the lines
+ * renderer would over a black window.
+ * Returns 1 if out of memory, 0 otherwise.
+ */
+int
+_Console_render_frame (Console_tty *tty)
+{
+    Console_Font *font = tty->font;
+    size_t size = (size_t)tty->window_width * tty->window_height * 4;
+    Console_Frame_Place place;
+    Console_Line *l, *src;
+    int ypos = -tty->scroll * font->line_height;
+    int h, i, cursor_len, head_rows;
+    unsigned char *frame;
+    Console_Color c;
+    Uint64 trace = _Console_trace_begin(tty);
+
+    frame = realloc(tty->frame, size);
+    if (!frame) {
+        Console_SetError("Not enough memory to draw frame!", "");
+        return 1;
+    }
+    tty->frame = frame;
+    tty->frame_width = tty->window_width;
+    tty->frame_height = tty->window_height;
+    for (i = 0; i < (int)(size / 4); i++) {
+        frame[i * 4 + 0] = frame[i * 4 + 1] = frame[i * 4 + 2] = 0;
+        frame[i * 4 + 3] = 255;
+    }
+    _Console_frame_blend(tty, 0, 0, tty->window_width, tty->window_height,
+            tty->bg_color, NULL, 0);
+
+    /* the same lines as _Console_render_lines, counted from the bottom */
+    for (l = tty->lines_head; l && ypos < tty->window_height; l = l->next) {
+        if (!_Console_line_visible(tty, l))
+            continue;
+        src = l == tty->lines_head ? tty->curr_line : l;
+        h = _Console_line_rows(tty, src) * font->line_height;
+        if (ypos + h > 0) {
+            place.top = tty->window_height - ypos - h;
+            _Console_layout_line(tty, src, _Console_glyph_to_frame, &place);
+        }
+        ypos += h;
+    }
+
+    /* the cursor is the font color at 75% opacity */
+    cursor_len = tty->prompt_len +
+        _Console_utf8_len(tty->curr_line->input, tty->cursor);
+    head_rows = _Console_line_rows(tty, tty->curr_line);
+    c = tty->font_color;
+    c.a *= 0.75f;
+    _Console_frame_blend(tty, (cursor_len % tty->wrap_len) * font->char_width,
+            tty->window_height - (head_rows - cursor_len / tty->wrap_len -
+            tty->scroll) * font->line_height, font->char_width,
+            font->line_height, c, NULL, 0);
+
+    if (tty->frame_graph)
+        _Console_graph_rects(tty, _Console_rect_to_frame, NULL);
+
+    _Console_trace_end(tty, "_Console_render_frame", trace);
+    return 0;
+}
+
+/*
+ * Set the current line. We can go UP (next) or DOWN (previous) through the 
+ * lines. This function essentially acts as a history viewer. This function
+ * will skip lines with zero length. The cursor is always set to the length of
+ * the line's input.
+ */
+enum Console_Line_Dir { LINE_UP, LINE_DOWN }; 
+void
+Console_SetCurrLine (Console_tty *tty, enum Console_Line_Dir dir)
+{
+    Console_Line *line;
+
+    /* history isn't browsed while filtering */
+    if (tty->filter_line)
+        return;
+
+    for (line = (dir == LINE_UP ? tty->curr_line->next : tty->curr_line->prev);
+         line != NULL;
+         line = (dir == LINE_UP ? line->next : line->prev))
+    {
+        if (line == tty->lines_head || line->len > 0)
+            break;
+    }
+
+    if (line == NULL)
+        return;
+
+    tty->curr_line = line;
+    tty->curr_line->len = line->len;
+    tty->cursor = line->len;
+    tty->rebuild_line = true;
+}
+
+/*
+ * Find or add the interned copy of `len' bytes of `text'.
+ * Returns the shared text, or NULL if out of memory.
+ */
+const char*
+_Console_intern (Console_tty *tty, const char *text, size_t len)
+{
+    Uint64 hash = _Console_hash_bytes(CONSOLE_HASH_INIT, text, len);
+    Console_Interned **bucket =
+        &tty->interned[hash % CONSOLE_INTERN_BUCKETS];
+    Console_Interned *in;
+
+    for (in = *bucket; in != NULL; in = in->next) {
+        if (in->hash == hash && in->len == len &&
+                memcmp(in->text, text, len) == 0) {
+            in->refs++;
+            return in->text;
+        }
+    }
+
+    in = malloc(sizeof(*in) + len);
+    if (!in)
+        return NULL;
+    in->hash = hash;
+    in->refs = 1;
+    in->len = len;
+    memcpy(in->text, text, len);
+    in->next = *bucket;
+    *bucket = in;
+    return in->text;
+}
+
+/*
+ * Release function of output the console made a copy of.
+ */
+void
+_Console_free_text (const char *text, void *data)
+{
+    free((char*)text);
+}
+
+/*
+ * Outputs an input function or generator is being called to set. The
+ * functions given `&out->text' find the rest of the output here, from any
+ * thread.
+ */
+static Console_Output *_Console_outputs_set = NULL;
+static SDL_SpinLock _Console_outputs_lock = 0;
+
+void
+_Console_begin_output (Console_Output *out)
+{
+    SDL_AtomicLock(&_Console_outputs_lock);
+    out->next_set = _Console_outputs_set;
+    _Console_outputs_set = out;
+    SDL_AtomicUnlock(&_Console_outputs_lock);
+}
+
+void
+_Console_end_output (Console_Output *out)
+{
+    Console_Output **p;
+
+    SDL_AtomicLock(&_Console_outputs_lock);
+    for (p = &_Console_outputs_set; *p; p = &(*p)->next_set) {
+        if (*p == out) {
+            *p = out->next_set;
+            break;
+        }
+    }
+    SDL_AtomicUnlock(&_Console_outputs_lock);
+    out->next_set = NULL;
+}
+
+/*
+ * Find the output `out' is the text of, or NULL if the console didn't pass
+ * it to an input function or generator.
+ */
+Console_Output*
+_Console_find_output (char **out)
+{
+    Console_Output *o;
+
+    SDL_AtomicLock(&_Console_outputs_lock);
+    for (o = _Console_outputs_set; o; o = o->next_set)
+        if (&o->text == out)
+            break;
+    SDL_AtomicUnlock(&_Console_outputs_lock);
+    return o;
+}
+
+/*
+ * Give an input function's output back to where it came from.
+ */
+void
+_Console_release_output (Console_Output *out)
+{
+    free(out->text);
+    if (out->view && out->release)
+        out->release(out->view, out->release_data);
+    out->text = NULL;
+    out->view = NULL;
+}
+
+/*
+ * Free the output of `line', or drop its reference if it's interned.
+ */
+void
+_Console_free_output (Console_tty *tty, Console_Line *line)
+{
+    Console_Interned *in, **p;
+
+    if (line->output && line->interned) {
+        in = (Console_Interned*)(line->output -
+                offsetof(Console_Interned, text));
+        if (--in->refs == 0) {
+            p = &tty->interned[in->hash % CONSOLE_INTERN_BUCKETS];
+            while (*p != in)
+                p = &(*p)->next;
+            *p = in->next;
+            free(in);
+        }
+    } else if (line->output && line->release) {
+        line->release(line->output, line->release_data);
+    }
+    line->output = NULL;
+    line->output_len = 0;
+    line->release = NULL;
+    line->interned = false;
+}
+
+/*
+ * The number of rows that fit in the window.
+ */
+int
+_Console_page_rows (Console_tty *tty)
+{
+    int rows = tty->window_height / tty->cell_height;
+    return rows > 1 ? rows : 1;
+}
+
+/*
+ * Get a line to add to the list. When the list is full the oldest line is
+ * taken off the tail and reused, keeping its buffers; its texture goes to
+ * the pool.
+ * Returns NULL on error.
+ */
+Console_Line*
+_Console_alloc_line (Console_tty *tty)
+{
+    Console_Line *line = NULL;
+
+    if (tty->lines_head == NULL)
+        tty->num_lines = 0;
+
+    if (tty->num_lines == tty->max_lines &&
+            tty->lines_tail != tty->lines_head) {
+        line = tty->lines_tail;
+        tty->lines_tail = line->prev;
+        tty->lines_tail->next = NULL;
+        _Console_gl_begin(tty);
+        _Console_release_texture(tty, line);
+        _Console_gl_end(tty);
+        _Console_free_output(tty, line);
+        /* the line being recalled from history is going away */
+        if (line == tty->curr_line) {
+            tty->curr_line = tty->lines_head;
+            tty->cursor = tty->curr_line->len;
+            tty->rebuild_line = true;
+        }
+        if (line == tty->saved_line)
+            tty->saved_line = NULL;
+    } else {
+        line = malloc(sizeof(*line));
+        if (!line) {
+            Console_SetError("Not enough memory to create line!", "");
+            return NULL;
+        }
+
+        line->input = malloc(sizeof(*line->input) * tty->max_input);
+        if (!line->input) {
+            Console_SetError("Not enough memory to create line text!", "");
+            free(line);
+            return NULL;
+        }
+        line->texture = 0;
+        line->spans = NULL;
+        line->max_spans = 0;
+        line->output = NULL;
+        line->output_len = 0;
+        line->release = NULL;
+        line->interned = false;
+        tty->num_lines++;
+    }
+
+    memset(line->input, 0, tty->max_input);
+
+    line->output_only = false;
+    line->repeat = 1;
+    line->match = false;
+    line->match_gen = 0;
+    line->num_spans = 0;
+    line->len = 0;
+    line->w = 0;
+    line->h = 0;
+    line->next = NULL;
+    line->prev = NULL;
+
+    return line;
+}
+
+/*
+ * Create a new line and set it to be the head. This function will
+ * automatically cycle-out lines if the number of lines has reached the max.
+ * If this function returns 0, the tty->lines_head will be a new line and
+ * tty->lines_head->next is previous line.
+ */
+int
+_Console_create_line (Console_tty *tty)
+{
+    assert(tty);
+    Console_Line *line = _Console_alloc_line(tty);
+
+    if (!line)
+        return 1;
+
+    /* insert into the doubly-linked list */
+    if (tty->lines_head == NULL) {
+        tty->lines_head = line;
+        tty->lines_tail = line;
+    } else {
+        line->next = tty->lines_head;
+        tty->lines_head->prev = line;
+        tty->lines_head = line;
+    }
+
+    /* make sure the current line becomes the new line */
+    tty->curr_line = tty->lines_head;
+    tty->cursor = 0;
+    tty->rebuild_line = true;
+
+    return 0;
+}
+
+void
+_Console_put_varint (FILE *f, Uint64 v)
+{
+    while (v >= 0x80) {
+        fputc((int)(v & 0x7f) | 0x80, f);
+        v >>= 7;
+    }
+    fputc((int)v, f);
+}
+
+/*
+ * Start a record of `type' if recording.
+ * Returns false if not recording.
+ */
+bool
+_Console_record (Console_tty *tty, enum Console_Rec_Type type)
+{
+    Uint64 now;
+
+    if (!tty->record)
+        return false;
+    now = SDL_GetPerformanceCounter();
+    fputc(type, tty->record);
+    _Console_put_varint(tty->record, (now - tty->record_last) * 1000000 /
+            SDL_GetPerformanceFrequency());
+    tty->record_last = now;
+    return true;
+}
+
+/*
+ * Record output from the input function or a generator.
+ */
+void
+_Console_record_output (Console_tty *tty, enum Console_Rec_Type type,
+        int flags, Console_Output *out)
+{
+    const char *text = out->text ? out->text : out->view;
+    size_t len = out->text ? strlen(out->text) : out->len;
+
+    if (!_Console_record(tty, type))
+        return;
+    if (text)
+        flags |= CONSOLE_REC_HAS_TEXT;
+    if (out->generator)
+        flags |= CONSOLE_REC_GENERATOR;
+    fputc(flags, tty->record);
+    _Console_put_varint(tty->record, text ? len : 0);
+    if (text)
+        fwrite(text, 1, len, tty->record);
+}
+
+/*
+ * Record the events the console acts on.
+ */
+void
+_Console_record_event (Console_tty *tty, SDL_Event *e)
+{
+    size_t len;
+
+    switch (e->type) {
+    case SDL_KEYDOWN:
+        if (_Console_record(tty, CONSOLE_REC_KEY)) {
+            _Console_put_varint(tty->record, (Uint32)e->key.keysym.sym);
+            _Console_put_varint(tty->record, e->key.keysym.mod);
+        }
+        break;
+
+    case SDL_TEXTINPUT:
+        if (_Console_record(tty, CONSOLE_REC_TEXT)) {
+            len = strlen(e->text.text);
+            fputc((int)len, tty->record);
+            fwrite(e->text.text, 1, len, tty->record);
+        }
+        break;
+
+    case SDL_WINDOWEVENT:
+        if (e->window.event == SDL_WINDOWEVENT_RESIZED &&
+                _Console_record(tty, CONSOLE_REC_RESIZE)) {
+            _Console_put_varint(tty->record, e->window.data1);
+            _Console_put_varint(tty->record, e->window.data2);
+        }
+        break;
+    }
+}
+
+/*
+ * Make room for `n' bytes in a remote client's buffer.
+ * Returns 1 when out of memory, 0 otherwise.
+ */
+int
+_Console_remote_reserve (char **buf, int *max, int n)
+{
+    char *p;
+    int new_max = *max > 0 ? *max : 4096;
+
+    if (n <= *max)
+        return 0;
+    while (new_max < n)
+        new_max *= 2;
+    p = realloc(*buf, new_max);
+    if (!p)
+        return 1;
+    *buf = p;
+    *max = new_max;
+    return 0;
+}
+
+/*
+ * Queue `len' bytes of `text' to be sent to a client. A client that can't be
+ * given its output is dropped.
+ */
+void
+_Console_remote_send (Console_RemoteClient *c, const char *text, size_t len)
+{
+    if (c->broken)
+        return;
+    if (len > INT_MAX - (size_t)c->out_len ||
+            _Console_remote_reserve(&c->out, &c->out_max,
+                c->out_len + (int)len)) {
+        c->broken = true;
+        return;
+    }
+    memcpy(c->out + c->out_len, text, len);
+    c->out_len += len;
+}
+
+/*
+ * Give output from the input function or a generator to the remote client
+ * whose command is running, if any, a line at a time.
+ */
+void
+_Console_remote_output (Console_tty *tty, Console_Output *out)
+{
+    const char *text = out->text ? out->text : out->view;
+    size_t len = out->text ? strlen(out->text) : out->len;
+    Console_RemoteClient *c;
+
+    if (!tty->remote || !tty->remote->running || !text || len == 0)
+        return;
+    c = tty->remote->running;
+    _Console_remote_send(c, text, len);
+    if (text[len - 1] != '\n')
+        _Console_remote_send(c, "\n", 1);
+}
+
+/*
+ * Add `prefix' and `text' to the session log as a line, if there is a log.
+ * This never waits for the writer, only for another thread adding a line.
+ */
+void
+_Console_log_line (Console_tty *tty, const char *prefix, size_t prefix_len,
+        const char *text, size_t len)
+{
+    Console_Log *log = tty->log;
+    size_t n = prefix_len + len + 1, max;
+    char *p;
+
+    if (!log)
+        return;
+    SDL_LockMutex(log->mutex);
+    if (n > CONSOLE_LOG_BUFFER - log->len) {
+        log->dropped += n;
+        goto unlock;
+    }
+    if (log->len + n > log->max) {
+        max = log->max > 0 ? log->max : CONSOLE_LOG_WAKE;
+        while (max < log->len + n)
+            max *= 2;
+        p = realloc(log->buf, max);
+        if (!p) {
+            log->dropped += n;
+            goto unlock;
+        }
+        log->buf = p;
+        log->max = max;
+    }
+    memcpy(log->buf + log->len, prefix, prefix_len);
+    memcpy(log->buf + log->len + prefix_len, text, len);
+    log->len += prefix_len + len;
+    if (len == 0 || text[len - 1] != '\n')
+        log->buf[log->len++] = '\n';
+    if (log->len >= CONSOLE_LOG_WAKE)
+        SDL_CondSignal(log->cond);
+unlock:
+    SDL_UnlockMutex(log->mutex);
+}
+
+/*
+ * Turn text set with Console_SetOutput into a view the console owns, so
+ * every output is a view from here on.
+ */
+void
+_Console_take_output (Console_Output *out)
+{
+    if (!out->text)
+        return;
+
+    /* text set with Console_SetOutput wins over a view */
+    if (out->view && out->release)
+        out->release(out->view, out->release_data);
+    out->view = out->text;
+    out->len = strlen(out->text);
+    out->release = _Console_free_text;
+    out->text = NULL;
+}
+
+/*
+ * Give the output's view to `line', sharing it with other lines if
+ * interning is on.
+ */
+void
+_Console_set_line_output (Console_tty *tty, Console_Line *line,
+        Console_Output *out)
+{
+    const char *text = NULL;
+
+    /* new text has to be matched against the filter again */
+    line->match_gen = 0;
+    /* when out of memory the line just keeps the output as it is */
+    if (out->view && tty->intern_output)
+        text = _Console_intern(tty, out->view, out->len);
+    if (text) {
+        line->output = text;
+        line->output_len = out->len;
+        line->interned = true;
+        _Console_release_output(out);
+    } else {
+        line->output = out->view;
+        line->output_len = out->len;
+        line->release = out->release;
+        line->release_data = out->release_data;
+    }
+}
+
+/*
+ * Let the generator go, telling it to free its state.
+ */
+void
+_Console_stop_generator (Console_tty *tty)
+{
+    if (tty->generator && tty->generator_finish)
+        tty->generator_finish(tty->generator_state);
+    tty->generator = NULL;
+    tty->generator_finish = NULL;
+    tty->generator_state = NULL;
+}
+
+/*
+ * Pull lines from the generator until they fill `rows' rows or it runs out.
+ * They go above the line being typed, which stays at the bottom.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+_Console_pull_output (Console_tty *tty, int rows)
+{
+    Console_Output out;
+    Console_Line *line;
+    int pulled = 0;
+    int more;
+    Uint64 start, trace;
+
+    while (tty->generator && pulled < rows) {
+        out = (Console_Output) { NULL, NULL, 0, NULL, NULL, NULL, NULL, NULL };
+        start = CONSOLE_STAT_NOW();
+        trace = _Console_trace_begin(tty);
+        _Console_begin_output(&out);
+        tty->in_generator = true;
+        more = tty->generator(tty->generator_state, &out.text);
+        tty->in_generator = false;
+        _Console_end_output(&out);
+        _Console_trace_end(tty, "generator", trace);
+        _Console_record_output(tty, CONSOLE_REC_LINE,
+                more ? CONSOLE_REC_MORE : 0, &out);
+        CONSOLE_STAT_SINCE(tty, input_time, start);
+        if (!more) {
+            _Console_release_output(&out);
+            _Console_stop_generator(tty);
+            break;
+        }
+        _Console_remote_output(tty, &out);
+        _Console_take_output(&out);
+        if (!out.view)
+            continue;
+        _Console_log_line(tty, "", 0, out.view, out.len);
+
+        line = _Console_alloc_line(tty);
+        if (!line) {
+            _Console_release_output(&out);
+            return 1;
+        }
+        line->output_only = true;
+        _Console_set_line_output(tty, line, &out);
+
+        /* the head may be alone if the tail was just reused */
+        line->prev = tty->lines_head;
+        line->next = tty->lines_head->next;
+        if (line->next)
+            line->next->prev = line;
+        else
+            tty->lines_tail = line;
+        tty->lines_head->next = line;
+
+        pulled += _Console_line_rows(tty, line);
+    }
+
+    tty->grid.rebuild = true;
+    if (_Console_m_uses_grid(tty))
+        tty->rebuild_textures = true;
+    return 0;
+}
+
+/*
+ * Scroll the view `rows' rows up, or down if negative. Scrolling down past
+ * the bottom pulls more lines from the generator, if there is one.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+_Console_scroll (Console_tty *tty, int rows)
+{
+    Console_Line *l;
+    int total = 0;
+    int max;
+
+    if (rows < 0 && tty->scroll == 0)
+        return _Console_pull_output(tty, -rows);
+
+    for (l = tty->lines_head; l != NULL; l = l->next)
+        if (_Console_line_visible(tty, l))
+            total += _Console_line_rows(tty, l == tty->lines_head ?
+                    tty->curr_line : l);
+    max = total - _Console_page_rows(tty);
+
+    tty->scroll += rows;
+    if (tty->scroll > max)
+        tty->scroll = max;
+    if (tty->scroll < 0)
+        tty->scroll = 0;
+    tty->grid.rebuild = true;
+    return 0;
+}
+
+/*
+ * Show only the lines that match the filter from now on.
+ */
+void
+_Console_filter_changed (Console_tty *tty)
+{
+    tty->filter_gen++;
+    tty->filter_changed = !_Console_m_uses_grid(tty);
+    tty->rebuild_textures = _Console_m_uses_grid(tty);
+    tty->grid.rebuild = true;
+    tty->scroll = 0;
+}
+
+/*
+ * Start filtering with an empty filter, typed in place of the current line.
+ * Returns 1 if out of memory, 0 otherwise.
+ */
+int
+_Console_begin_filter (Console_tty *tty)
+{
+    Console_Line *f;
+
+    if (tty->filter_line)
+        return 0;
+
+    f = calloc(1, sizeof(*f));
+    if (f)
+        f->input = calloc(tty->max_input, 1);
+    if (!f || !f->input) {
+        free(f);
+        Console_SetError("Not enough memory to filter lines!", "");
+        return 1;
+    }
+    f->repeat = 1;
+
+    tty->filter_line = f;
+    tty->curr_line = f;
+    tty->cursor = 0;
+    tty->rebuild_line = true;
+    _Console_filter_changed(tty);
+    return 0;
+}
+
+/*
+ * Stop filtering and go back to the line being typed.
+ */
+void
+_Console_end_filter (Console_tty *tty)
+{
+    Console_Line *f = tty->filter_line;
+
+    if (!f)
+        return;
+
+    tty->filter_line = NULL;
+    free(f->input);
+    free(f->spans);
+    free(f);
+
+    tty->curr_line = tty->lines_head;
+    tty->cursor = tty->curr_line->len;
+    tty->rebuild_line = true;
+    _Console_filter_changed(tty);
+}
+
+int
+_Console_compare_floats (const void *a, const void *b)
+{
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * perf [frames | graph | reset]: percentiles of the last frame times,
+ * showing the frame graph, or forgetting the frame times.
+ */
+int
+_Console_cmd_perf (Console_tty *tty, const char *args, char **output)
+{
+    float times[CONSOLE_FRAME_TIMES];
+    char buf[160];
+    int n = tty->num_frame_times;
+    int i, want;
+
+    if (strcmp(args, "graph") == 0) {
+        tty->frame_graph = !tty->frame_graph;
+        Console_SetOutput(output, tty->frame_graph ? "frame graph on" :
+                "frame graph off");
+        return 0;
+    }
+    if (strcmp(args, "reset") == 0) {
+        tty->num_frame_times = 0;
+        tty->frame_time_next = 0;
+        Console_SetOutput(output, "frame times cleared");
+        return 0;
+    }
+    if (args[0] != '\0') {
+        want = atoi(args);
+        if (want <= 0) {
+            Console_SetOutput(output, "usage: perf [frames | graph | reset]");
+            return 0;
+        }
+        if (want < n)
+            n = want;
+    }
+    if (n == 0) {
+        Console_SetOutput(output, "no frame times yet");
+        return 0;
+    }
+
+    for (i = 0; i < n; i++)
+        times[i] = _Console_frame_time(tty, i);
+    qsort(times, n, sizeof(*times), _Console_compare_floats);
+    /* nearest rank percentiles */
+    snprintf(buf, sizeof(buf), "last %d frames: p50 %.2f ms, p99 %.2f ms, "
+            "max %.2f ms", n, times[(n * 50 + 99) / 100 - 1],
+            times[(n * 99 + 99) / 100 - 1], times[n - 1]);
+    Console_SetOutput(output, buf);
+    return 0;
+}
+
+/*
+ * exec <file>: run the commands in a file. They're run once this command's
+ * line is done, by Console_NewLine.
+ */
+int
+_Console_cmd_exec (Console_tty *tty, const char *args, char **output)
+{
+    char buf[320];
+
+    if (args[0] == '\0') {
+        Console_SetOutput(output, "usage: exec <file>");
+        return 0;
+    }
+    if (tty->exec_depth == CONSOLE_EXEC_DEPTH) {
+        Console_SetOutput(output, "exec: files are nested too deep");
+        return 0;
+    }
+    tty->exec_file = fopen(args, "r");
+    if (!tty->exec_file) {
+        snprintf(buf, sizeof(buf), "exec: can't open %s", args);
+        Console_SetOutput(output, buf);
+    }
+    return 0;
+}
+
+/* A command the console runs itself instead of the input function */
+typedef struct _Console_Builtin {
+    const char *name;
+    int (*func) (Console_tty *tty, const char *args, char **output);
+} Console_Builtin;
+
+static const Console_Builtin _Console_builtins[] = {
+    { "perf", _Console_cmd_perf },
+    { "exec", _Console_cmd_exec },
+};
+
+/*
+ * Find the built-in command `input' runs, pointing `args' past its name.
+ * Returns NULL if it isn't one.
+ */
+const Console_Builtin*
+_Console_find_builtin (const char *input, const char **args)
+{
+    size_t i, len = strcspn(input, " ");
+
+    for (i = 0; i < sizeof(_Console_builtins) / sizeof(*_Console_builtins);
+            i++) {
+        if (strlen(_Console_builtins[i].name) == len &&
+                strncmp(input, _Console_builtins[i].name, len) == 0) {
+            *args = input + len + strspn(input + len, " ");
+            return &_Console_builtins[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * When a newline occurs, we use the head line's text as input to the input
+ * function given in Console(). We then render any output to that line's
+ * texture which will be the final time that texture is updated (excluding
+ * screen resizes and font changes).
+ */
+int
+_Console_new_line (Console_tty *tty,
+                   Console_InputFunction input_func,
+                   void *input_func_data)
+{
+    Console_Output out = { NULL, NULL, 0, NULL, NULL, NULL, NULL, NULL };
+    Console_Line *head = tty->lines_head;
+    Console_Line *prev = head->next;
+    Uint64 start, trace;
+    int failed;
+    const Console_Builtin *builtin;
+    const char *args;
+
+    /* a new command ends the output of the last one */
+    _Console_stop_generator(tty);
+    tty->scroll = 0;
+
+    if (head->len > 0)
+        _Console_log_line(tty, tty->prompt, tty->prompt_len, head->input,
+                head->len);
+
+    /*
+     * Use the text as input to the function given. The output belongs to the
+     * head too so the line can be rasterized again later.
+     */
+    builtin = tty->builtins ? _Console_find_builtin(head->input, &args) : NULL;
+    if (head->len > 0 && (builtin || input_func)) {
+        start = CONSOLE_STAT_NOW();
+        trace = _Console_trace_begin(tty);
+        _Console_begin_output(&out);
+        tty->in_command = true;
+        if (builtin) {
+            failed = builtin->func(tty, args, &out.text);
+        } else {
+            failed = input_func(head->input, input_func_data, &out.text);
+            _Console_record_output(tty, CONSOLE_REC_OUTPUT,
+                    failed ? CONSOLE_REC_FAILED : 0, &out);
+        }
+        tty->in_command = false;
+        _Console_end_output(&out);
+        _Console_trace_end(tty, builtin ? builtin->name : "input_func",
+                trace);
+        CONSOLE_STAT_SINCE(tty, input_time, start);
+        if (failed) {
+            Console_SetError("Console input function failed: ",
+                    out.text ? out.text : "");
+            _Console_release_output(&out);
+            if (out.generator && out.generator_finish)
+                out.generator_finish(out.generator_state);
+            return 1;
+        }
+        _Console_remote_output(tty, &out);
+        _Console_take_output(&out);
+        if (out.view)
+            _Console_log_line(tty, "", 0, out.view, out.len);
+
+        /*
+         * The same command printing the same thing again counts up the line
+         * before instead, and the head is cleared for the next command.
+         */
+        if (tty->collapse_repeats && out.view && !out.generator && prev &&
+                prev->output && !prev->output_only &&
+                strcmp(prev->input, head->input) == 0 &&
+                prev->output_len == out.len &&
+                memcmp(prev->output, out.view, out.len) == 0) {
+            _Console_release_output(&out);
+            prev->repeat++;
+            prev->match_gen = 0;
+            memset(head->input, 0, head->len);
+            head->len = 0;
+            tty->curr_line = head;
+            tty->cursor = 0;
+            tty->rebuild_line = true;
+            tty->grid.rebuild = true;
+            if (_Console_m_uses_grid(tty))
+                tty->rebuild_textures = true;
+            else if (_Console_update_line_texture(tty, prev, prev))
+                return 1;
+            return 0;
+        }
+
+        _Console_set_line_output(tty, head, &out);
+
+        /* Then render the line a final time with the output */
+        if (_Console_m_uses_grid(tty))
+            tty->rebuild_textures = true;
+        else if (_Console_update_line_texture(tty, head, head))
+            return 1;
+    }
+
+    /* Finally, actually create a new line */
+    if (_Console_create_line(tty))
+        return 1;
+
+    /* every line moves up a row in the grid */
+    tty->grid.rebuild = true;
+
+    /* a generator's output starts with what fills the window */
+    if (out.generator) {
+        tty->generator = out.generator;
+        tty->generator_finish = out.generator_finish;
+        tty->generator_state = out.generator_state;
+        if (_Console_pull_output(tty, _Console_page_rows(tty)))
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Run `command' as if it was typed and entered. What the user was typing,
+ * the line recalled from history and the filter are put back afterwards.
+ * When the output goes to a remote client a generator
+ * is handed to the client to be pulled from as it takes the output, and the
+ * console's own generator is left alone.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+_Console_run_command (Console_tty *tty, const char *command)
+{
+    Console_Line *head = tty->lines_head;
+    Console_RemoteClient *c = tty->remote ? tty->remote->running : NULL;
+    Console_GeneratorFunction generator = tty->generator;
+    Console_FinishFunction finish = tty->generator_finish;
+    void *state = tty->generator_state;
+    Console_Line *filter = tty->filter_line;
+    bool on_head = tty->curr_line == head;
+    char *typed = NULL;
+    int typed_len = head->len, cursor = tty->cursor;
+    int len = strlen(command);
+    Uint64 trace;
+    int ret;
+
+    if (typed_len > 0) {
+        typed = malloc(typed_len + 1);
+        if (!typed) {
+            Console_SetError("Not enough memory to run command!", "");
+            return 1;
+        }
+        memcpy(typed, head->input, typed_len + 1);
+    }
+    tty->saved_line = on_head || tty->curr_line == filter ? NULL :
+        tty->curr_line;
+
+    /* long commands are cut at a character boundary */
+    if (len >= tty->max_input) {
+        len = tty->max_input - 1;
+        while (len > 0 && (command[len] & 0xc0) == 0x80)
+            len--;
+    }
+    memset(head->input, 0, tty->max_input);
+    memcpy(head->input, command, len);
+    head->len = len;
+
+    if (c) {
+        tty->generator = NULL;
+        tty->generator_finish = NULL;
+        tty->generator_state = NULL;
+    }
+    trace = _Console_trace_begin(tty);
+    ret = _Console_new_line(tty, tty->input_func, tty->input_func_data);
+    _Console_trace_end(tty, "Console_NewLine", trace);
+    if (c) {
+        /* commands from a file end the output of the one before, as typed */
+        if (c->generator && c->generator_finish)
+            c->generator_finish(c->generator_state);
+        c->generator = tty->generator;
+        c->generator_finish = tty->generator_finish;
+        c->generator_state = tty->generator_state;
+        tty->generator = generator;
+        tty->generator_finish = finish;
+        tty->generator_state = state;
+    }
+
+    head = tty->lines_head;
+    if (typed) {
+        memset(head->input, 0, tty->max_input);
+        memcpy(head->input, typed, typed_len);
+        head->len = typed_len;
+        free(typed);
+    }
+    if (tty->filter_line)
+        tty->curr_line = tty->filter_line;
+    else if (tty->saved_line)
+        tty->curr_line = tty->saved_line;
+    else
+        tty->curr_line = head;
+    /* the cursor stays put unless its line went away */
+    if (tty->curr_line == filter || tty->curr_line == tty->saved_line ||
+            (on_head && tty->curr_line == head))
+        tty->cursor = cursor;
+    else
+        tty->cursor = tty->curr_line->len;
+    tty->saved_line = NULL;
+    tty->rebuild_line = true;
+    return ret;
+}
+
+/*
+ * Run every command in `f' as if typed, skipping blank lines and lines
+ * starting with `#', then close it. Files given to `exec' are run in place.
+ * Lines aren't laid out or rasterized until they're drawn, so a long file
+ * costs about what its commands do.
+ * Returns 1 if a command failed, 0 otherwise.
+ */
+int
+_Console_exec (Console_tty *tty, FILE *f)
+{
+    FILE *files[CONSOLE_EXEC_DEPTH];
+    char *line = NULL;
+    size_t max = 0;
+    ssize_t len;
+    int base = tty->exec_depth;
+    int ret = 0;
+    Uint64 trace;
+
+    if (base == CONSOLE_EXEC_DEPTH) {
+        fclose(f);
+        Console_SetError("Command files are nested too deep!", "");
+        return 1;
+    }
+    trace = _Console_trace_begin(tty);
+
+    /* files only this call runs are kept from `base' on */
+    files[tty->exec_depth++ - base] = f;
+    while (tty->exec_depth > base) {
+        f = files[tty->exec_depth - 1 - base];
+        if (ret != 0 || (len = getline(&line, &max, f)) == -1) {
+            fclose(f);
+            tty->exec_depth--;
+            continue;
+        }
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (line[strspn(line, " \t")] == '\0' ||
+                line[strspn(line, " \t")] == '#')
+            continue;
+
+        ret = _Console_run_command(tty, line);
+        if (tty->exec_file) {
+            f = tty->exec_file;
+            tty->exec_file = NULL;
+            if (tty->exec_depth == CONSOLE_EXEC_DEPTH) {
+                fclose(f);
+                Console_SetError("Command files are nested too deep!", "");
+                ret = 1;
+            } else {
+                files[tty->exec_depth++ - base] = f;
+            }
+        }
+    }
+    free(line);
+    _Console_trace_end(tty, "exec", trace);
+    return ret;
+}
+
+int
+Console_NewLine (Console_tty *tty,
+                 Console_InputFunction input_func,
+                 void *input_func_data)
+{
+    Console_Line *head = tty->lines_head;
+    Uint64 trace = _Console_trace_begin(tty);
+    FILE *f;
+    int ret;
+
+    _Console_end_filter(tty);
+    /*
+     * If the newline came from history, copy that command to the current
+     * head to keep history consistent.
+     */
+    if (head != tty->curr_line) {
+        strcpy(head->input, tty->curr_line->input);
+        head->len = tty->curr_line->len;
+    }
+    ret = _Console_new_line(tty, input_func, input_func_data);
+    f = tty->exec_file;
+
+    _Console_trace_end(tty, "Console_NewLine", trace);
+
+    /* `exec' runs its file once its own line is done */
+    if (f) {
+        tty->exec_file = NULL;
+        if (ret == 0)
+            ret = _Console_exec(tty, f);
+        else
+            fclose(f);
+    }
+    return ret;
+}
+
+/*
+ * Move the log file to `path.1', that one to `path.2' and so on, keeping
+ * `keep' of them, and start an empty file.
+ */
+void
+_Console_log_rotate (Console_Log *log)
+{
+    size_t len = strlen(log->path) + 16;
+    int i;
+
+    fclose(log->file);
+    for (i = log->keep; i > 0; i--) {
+        if (i == 1)
+            snprintf(log->from, len, "%s", log->path);
+        else
+            snprintf(log->from, len, "%s.%d", log->path, i - 1);
+        snprintf(log->to, len, "%s.%d", log->path, i);
+        rename(log->from, log->to);
+    }
+    log->file = fopen(log->path, "w");
+    log->size = 0;
+    if (!log->file)
+        fprintf(stderr, "Warning: Failed to reopen console log %s\n",
+                log->path);
+}
+
+/*
+ * Write out what was logged, rotating the file once it's too big.
+ */
+void
+_Console_log_write (Console_Log *log, const char *text, size_t len,
+        size_t dropped)
+{
+    char note[64];
+    int n;
+
+    if (!log->file)
+        return;
+    if (dropped > 0) {
+        n = snprintf(note, sizeof(note), "[%zu bytes not logged]\n", dropped);
+        fwrite(note, 1, n, log->file);
+        log->size += n;
+    }
+    if (len > 0) {
+        fwrite(text, 1, len, log->file);
+        log->size += len;
+    }
+    fflush(log->file);
+    if (log->max_size > 0 && log->size >= log->max_size)
+        _Console_log_rotate(log);
+}
+
+int
+_Console_log_thread (void *data)
+{
+    Console_Log *log = data;
+    char *text;
+    size_t len, max, dropped;
+    bool stop;
+
+    SDL_LockMutex(log->mutex);
+    for (;;) {
+        if (!log->stop && log->len < CONSOLE_LOG_WAKE)
+            SDL_CondWaitTimeout(log->cond, log->mutex, CONSOLE_LOG_FLUSH);
+
+        /* take what was logged and leave the spare buffer to fill */
+        text = log->buf;
+        len = log->len;
+        max = log->max;
+        log->buf = log->spare;
+        log->max = log->spare_max;
+        log->len = 0;
+        log->spare = text;
+        log->spare_max = max;
+        dropped = log->dropped;
+        log->dropped = 0;
+        stop = log->stop;
+        SDL_UnlockMutex(log->mutex);
+
+        _Console_log_write(log, text, len, dropped);
+        if (stop)
+            return 0;
+        SDL_LockMutex(log->mutex);
+    }
+}
+
+/*
+ * Free the log. The writer thread has to be stopped.
+ */
+void
+_Console_log_free (Console_Log *log)
+{
+    if (log->file)
+        fclose(log->file);
+    if (log->cond)
+        SDL_DestroyCond(log->cond);
+    if (log->mutex)
+        SDL_DestroyMutex(log->mutex);
+    free(log->buf);
+    free(log->spare);
+    free(log->from);
+    free(log->to);
+    free(log->path);
+    free(log);
+}
+
+/*
+ * Let the generator `c' is waiting on go.
+ */
+void
+_Console_remote_stop_generator (Console_RemoteClient *c)
+{
+    if (c->generator && c->generator_finish)
+        c->generator_finish(c->generator_state);
+    c->generator = NULL;
+    c->generator_finish = NULL;
+    c->generator_state = NULL;
+}
+
+/*
+ * Pull a page of the output `c' is waiting on, with the console's own
+ * generator put aside meanwhile.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+_Console_remote_pull (Console_tty *tty, Console_RemoteClient *c)
+{
+    Console_GeneratorFunction generator = tty->generator;
+    Console_FinishFunction finish = tty->generator_finish;
+    void *state = tty->generator_state;
+    int ret;
+
+    tty->generator = c->generator;
+    tty->generator_finish = c->generator_finish;
+    tty->generator_state = c->generator_state;
+    ret = _Console_pull_output(tty, _Console_page_rows(tty));
+    c->generator = tty->generator;
+    c->generator_finish = tty->generator_finish;
+    c->generator_state = tty->generator_state;
+    tty->generator = generator;
+    tty->generator_finish = finish;
+    tty->generator_state = state;
+    return ret;
+}
+
+/*
+ * Run whole commands `c' has sent, in order, while it has room for the
+ * output, until a batch of output is made. A command's generator is pulled
+ * from a page at a time before the next command runs. Each command's output
+ * is followed by a NUL byte so pipelined commands can be told apart.
+ * Returns 1 if a command failed, 0 otherwise.
+ */
+int
+_Console_remote_run (Console_tty *tty, Console_Remote *r,
+        Console_RemoteClient *c)
+{
+    char *line = c->in, *end, *stop = c->in + c->in_len;
+    const char *error;
+    FILE *record, *f;
+    int start = c->out_len;
+    int failed, ret = 0;
+
+    /* remote commands aren't part of a recorded session */
+    record = tty->record;
+    tty->record = NULL;
+    r->running = c;
+    while (!c->broken && c->out_len - c->out_sent < CONSOLE_REMOTE_BUFFER &&
+            c->out_len - start < CONSOLE_REMOTE_BATCH) {
+        if (c->generator) {
+            failed = _Console_remote_pull(tty, c);
+        } else if ((end = memchr(line, '\n', stop - line)) != NULL) {
+            *end = '\0';
+            if (end > line && end[-1] == '\r')
+                end[-1] = '\0';
+            failed = _Console_run_command(tty, line);
+            if (tty->exec_file) {
+                f = tty->exec_file;
+                tty->exec_file = NULL;
+                if (!failed)
+                    failed = _Console_exec(tty, f);
+                else
+                    fclose(f);
+            }
+            line = end + 1;
+        } else {
+            break;
+        }
+        if (failed) {
+            _Console_remote_stop_generator(c);
+            error = Console_GetError();
+            _Console_remote_send(c, "error: ", 7);
+            _Console_remote_send(c, error, strlen(error));
+            _Console_remote_send(c, "\n", 1);
+            ret = 1;
+        }
+        if (!c->generator)
+            _Console_remote_send(c, "", 1);
+    }
+    r->running = NULL;
+    tty->record = record;
+    c->in_len = stop - line;
+    memmove(c->in, line, c->in_len);
+    return ret;
+}
+
+/*
+ * Read what a client has sent without blocking. The end of its input ends
+ * the last command too. A client whose line fills the buffer without ending
+ * is dropped, as the line could never be run.
+ */
+void
+_Console_remote_read (Console_RemoteClient *c)
+{
+    ssize_t n;
+
+    while (!c->eof && c->in_len < CONSOLE_REMOTE_BUFFER) {
+        if (_Console_remote_reserve(&c->in, &c->in_max,
+                    c->in_len + CONSOLE_REMOTE_READ)) {
+            c->broken = true;
+            return;
+        }
+        n = read(c->fd, c->in + c->in_len, c->in_max - c->in_len);
+        if (n > 0) {
+            c->in_len += n;
+        } else if (n == 0) {
+            c->eof = true;
+            if (c->in_len > 0 && c->in[c->in_len - 1] != '\n')
+                c->in[c->in_len++] = '\n';
+        } else if (errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                c->broken = true;
+            return;
+        }
+    }
+    if (c->in_len >= CONSOLE_REMOTE_BUFFER && !memchr(c->in, '\n', c->in_len))
+        c->broken = true;
+}
+
+/*
+ * Send a client as much of its output as it takes without blocking.
+ */
+void
+_Console_remote_flush (Console_RemoteClient *c)
+{
+    ssize_t n;
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+
+    while (!c->broken && c->out_sent < c->out_len) {
+        n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+                flags);
+        if (n > 0) {
+            c->out_sent += n;
+        } else if (n < 0 && errno != EINTR) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                c->broken = true;
+            return;
+        }
+    }
+    c->out_len = 0;
+    c->out_sent = 0;
+}
+
+/*
+ * Wake the remote thread from poll(), e.g. when there's output to send.
+ */
+void
+_Console_remote_wake (Console_Remote *r)
+{
+    ssize_t n;
+
+    if (r->wake[1] != -1) {
+        n = write(r->wake[1], "", 1);
+        (void)n;
+    }
+}
+
+/*
+ * Commands that may rasterize lines are run where the console is drawn,
+ * which is only known to have GL when there's no remote thread.
+ */
+bool
+_Console_remote_may_run (Console_tty *tty, Console_Remote *r)
+{
+    return !r->thread || tty->headless;
+}
+
+/*
+ * Wait up to `timeout' ms for clients, then read what they sent, run their
+ * commands if they may be run here, send their output and take new clients.
+ * The console is only locked while clients are handled, not while waiting.
+ * Returns 1 if a command failed, 0 otherwise.
+ */
+int
+_Console_remote_service (Console_tty *tty, Console_Remote *r, int timeout)
+{
+    struct pollfd fds[CONSOLE_REMOTE_CLIENTS + 2];
+    Console_RemoteClient *c;
+    char drain[64];
+    bool pending = false;
+    int i, n, fd, ret = 0;
+
+    _Console_lock(tty);
+    fds[0] = (struct pollfd) { r->fd, POLLIN, 0 };
+    fds[1] = (struct pollfd) { r->wake[0], POLLIN, 0 };
+    for (i = 0; i < r->num_clients; i++) {
+        c = &r->clients[i];
+        fds[i + 2] = (struct pollfd) { c->fd, 0, 0 };
+        if (!c->eof && c->in_len < CONSOLE_REMOTE_BUFFER)
+            fds[i + 2].events |= POLLIN;
+        if (c->out_sent < c->out_len)
+            fds[i + 2].events |= POLLOUT;
+        /* output left to pull or commands left to run are work to do now */
+        if ((c->generator ||
+                    (c->in_len > 0 && memchr(c->in, '\n', c->in_len))) &&
+                _Console_remote_may_run(tty, r) &&
+                c->out_len - c->out_sent < CONSOLE_REMOTE_BUFFER)
+            pending = true;
+    }
+    n = r->num_clients + 2;
+    SDL_UnlockMutex(tty->mutex);
+
+    /* clients only come and go here, so the indices still hold after */
+    if (poll(fds, n, pending ? 0 : timeout) <= 0 && !pending)
+        return 0;
+
+    _Console_lock(tty);
+    if (fds[1].revents & POLLIN)
+        while (read(r->wake[0], drain, sizeof(drain)) > 0)
+            ;
+    for (i = 0; i < n - 2; i++) {
+        c = &r->clients[i];
+        if (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))
+            _Console_remote_read(c);
+        if (_Console_remote_may_run(tty, r) && _Console_remote_run(tty, r, c))
+            ret = 1;
+        _Console_remote_flush(c);
+    }
+
+    if (fds[0].revents & POLLIN) {
+        while ((fd = accept(r->fd, NULL, NULL)) != -1) {
+            if (r->num_clients == CONSOLE_REMOTE_CLIENTS ||
+                    fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+                close(fd);
+                continue;
+            }
+            c = &r->clients[r->num_clients++];
+            memset(c, 0, sizeof(*c));
+            c->fd = fd;
+        }
+    }
+
+    /* clients are let go once everything they sent has run and been sent */
+    for (i = r->num_clients - 1; i >= 0; i--) {
+        c = &r->clients[i];
+        if (!c->broken && !(c->eof && c->in_len == 0 && c->out_len == 0 &&
+                    !c->generator))
+            continue;
+        _Console_remote_stop_generator(c);
+        close(c->fd);
+        free(c->in);
+        free(c->out);
+        r->clients[i] = r->clients[--r->num_clients];
+    }
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
+
+int
+_Console_remote_thread (void *data)
+{
+    Console_Remote *r = data;
+
+    while (!SDL_AtomicGet(&r->stop))
+        _Console_remote_service(r->tty, r, -1);
+    return 0;
+}
+
+/*
+ * Serve remote clients from Console_Draw. With a remote thread only the
+ * commands it left to be run where the console is drawn are run here.
+ * Returns 1 if a command failed, 0 otherwise.
+ */
+int
+_Console_remote_draw (Console_tty *tty)
+{
+    Console_Remote *r = tty->remote;
+    Console_RemoteClient *c;
+    bool wake = false;
+    int i, ret = 0;
+
+    if (!r->thread)
+        return _Console_remote_service(tty, r, 0);
+    if (_Console_remote_may_run(tty, r))
+        return 0;
+    for (i = 0; i < r->num_clients; i++) {
+        c = &r->clients[i];
+        if (_Console_remote_run(tty, r, c))
+            ret = 1;
+        _Console_remote_flush(c);
+        /* the thread sends the rest and lets finished clients go */
+        if (c->out_len > 0 || c->eof || c->broken)
+            wake = true;
+    }
+    if (wake)
+        _Console_remote_wake(r);
+    return ret;
+}
+
+/*
+ * Close the socket and every client. The remote thread has to be stopped.
+ */
+void
+_Console_remote_free (Console_Remote *r)
+{
+    int i;
+
+    for (i = 0; i < r->num_clients; i++) {
+        _Console_remote_stop_generator(&r->clients[i]);
+        close(r->clients[i].fd);
+        free(r->clients[i].in);
+        free(r->clients[i].out);
+    }
+    if (r->fd != -1)
+        close(r->fd);
+    if (r->bound)
+        unlink(r->path);
+    if (r->wake[0] != -1)
+        close(r->wake[0]);
+    if (r->wake[1] != -1)
+        close(r->wake[1]);
+    free(r->path);
+    free(r);
+}
+
+/*
+ * Glyph cache files hold a font's metrics and every glyph rendered with it,
+ * so later runs can skip FreeType until they need a glyph the file doesn't
+ * have. The file is mapped and the glyph bitmaps are used where they are.
+ * Files are in native byte order and are keyed by a hash of the font file's
+ * path, size and modification time, the pixel size, the cache version and the
+ * FreeType version.
+ *
+ * Layout: the header, `num_glyphs' glyph records and then the bitmaps.
+ */
+#define CONSOLE_CACHE_MAGIC   "SDLCONS"
+#define CONSOLE_FT_VERSION \
+    (FREETYPE_MAJOR << 16 | FREETYPE_MINOR << 8 | FREETYPE_PATCH)
+
+typedef struct _Console_CacheHeader {
+    char magic[8];
+    Uint32 version;
+    Uint32 ft_version;
+    Uint64 font_hash;
+    Sint32 font_size;
+    Sint32 sdf;
+    Sint32 char_width;
+    float advance;
+    float line_height;
+    float baseline;
+    Uint32 num_glyphs;
+} Console_CacheHeader;
+
+typedef struct _Console_CacheGlyph {
+    Uint32 c;
+    Sint32 width;
+    Sint32 rows;
+    Sint32 top;
+    Sint32 left;
+    Uint32 offset;  /* of the bitmap from the start of the file */
+} Console_CacheGlyph;
+
+/*
+ * Hash the path, size and modification time of the file at `path', which
+ * change whenever the file is replaced, without reading the file.
+ * Returns 1 if there's no such file, 0 otherwise.
+ */
+int
+_Console_hash_file (const char *path, Uint64 *hash)
+{
+    struct stat st;
+    Sint64 stamp[3];
+
+    if (stat(path, &st) != 0 || st.st_size == 0)
+        return 1;
+    stamp[0] = st.st_size;
+    stamp[1] = st.st_mtim.tv_sec;
+    stamp[2] = st.st_mtim.tv_nsec;
+    *hash = _Console_hash_bytes(CONSOLE_HASH_INIT, path, strlen(path) + 1);
+    *hash = _Console_hash_bytes(*hash, stamp, sizeof(stamp));
+    return 0;
+}
+
+void
+_Console_font_cache_file (Console_Font *font, char *buf, size_t len)
+{
+    snprintf(buf, len, "%s/font-%016llx-%d%s.cache", font->cache_path,
+            (unsigned long long)font->hash, font->font_size,
+            font->sdf ? "-sdf" : "");
+}
+
+/*
+ * Load the font's metrics and glyphs from its cache file.
+ * Returns 1 if there's no usable cache file, 0 otherwise.
+ */
+int
+_Console_load_font_cache (Console_Font *font)
+{
+    const Console_CacheHeader *h;
+    const Console_CacheGlyph *cg;
+    Console_Glyph *g;
+    char path[4096];
+    struct stat st;
+    unsigned char *map;
+    Uint32 i;
+    int fd;
+
+    if (!font->cache_path || _Console_hash_file(font->path, &font->hash))
+        return 1;
+    font->hashed = true;
+
+    _Console_font_cache_file(font, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*h)) {
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    h = (const Console_CacheHeader*)map;
+    cg = (const Console_CacheGlyph*)(h + 1);
+    if (memcmp(h->magic, CONSOLE_CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CONSOLE_CACHE_VERSION ||
+        h->ft_version != CONSOLE_FT_VERSION ||
+        h->font_hash != font->hash ||
+        h->font_size != font->font_size ||
+        h->sdf != font->sdf ||
+        h->num_glyphs >
+            (st.st_size - sizeof(*h)) / sizeof(Console_CacheGlyph))
+        goto error;
+
+    for (i = 0; i < h->num_glyphs; i++, cg++) {
+        size_t n = (size_t)cg->width * cg->rows;
+        if (cg->c > 0x10FFFF || cg->width < 0 || cg->rows < 0 ||
+            cg->offset + n > (size_t)st.st_size)
+            goto error;
+        g = _Console_glyph_entry(font, cg->c);
+        if (!g)
+            goto error;
+        g->bitmap = n > 0 ? map + cg->offset : NULL;
+        g->width = cg->width;
+        g->rows = cg->rows;
+        g->top = cg->top;
+        g->left = cg->left;
+        g->slot = 0;
+        g->loaded = true;
+        g->mapped = true;
+    }
+
+    font->char_width = h->char_width;
+    font->advance = h->advance;
+    font->line_height = h->line_height;
+    font->baseline = h->baseline;
+    font->num_glyphs = font->cached_glyphs = h->num_glyphs;
+    font->map = map;
+    font->map_len = st.st_size;
+    return 0;
+
+error:
+    _Console_destroy_glyphs(font);
+    munmap(map, st.st_size);
+    return 1;
+}
+
+/*
+ * Write the font's cache file again if glyphs were loaded since it was read.
+ * The file is written next to the old one and renamed over it so processes
+ * using the old one can carry on.
+ */
+void
+_Console_save_font_cache (Console_Font *font)
+{
+    Console_CacheHeader h;
+    Console_CacheGlyph cg;
+    Console_Glyph *g;
+    char path[4096];
+    char tmp[4096 + 32];
+    Uint32 offset;
+    FILE *f;
+    int i, j, pass;
+
+    if (!font->cache_path || !font->hashed ||
+            font->num_glyphs == font->cached_glyphs)
+        return;
+
+    mkdir(font->cache_path, 0755);
+    _Console_font_cache_file(font, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+    f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(stderr, "Warning: couldn't write glyph cache %s\n", tmp);
+        return;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CONSOLE_CACHE_MAGIC, sizeof(h.magic));
+    h.version = CONSOLE_CACHE_VERSION;
+    h.ft_version = CONSOLE_FT_VERSION;
+    h.font_hash = font->hash;
+    h.font_size = font->font_size;
+    h.sdf = font->sdf;
+    h.char_width = font->char_width;
+    h.advance = font->advance;
+    h.line_height = font->line_height;
+    h.baseline = font->baseline;
+    h.num_glyphs = font->num_glyphs;
+    fwrite(&h, sizeof(h), 1, f);
+
+    /* the records first, then the bitmaps in the same order */
+    offset = sizeof(h) + font->num_glyphs * sizeof(cg);
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < CONSOLE_GLYPH_PAGES; i++) {
+            if (!font->pages[i])
+                continue;
+            for (j = 0; j < CONSOLE_GLYPH_PAGE_SIZE; j++) {
+                g = &font->pages[i]->glyphs[j];
+                if (!g->loaded)
+                    continue;
+                if (pass == 1) {
+                    if (g->bitmap)
+                        fwrite(g->bitmap, g->width * g->rows, 1, f);
+                    continue;
+                }
+                cg = (Console_CacheGlyph) {
+                    (i << CONSOLE_GLYPH_PAGE_BITS) | j,
+                    g->width, g->rows, g->top, g->left, offset
+                };
+                fwrite(&cg, sizeof(cg), 1, f);
+                if (g->bitmap)
+                    offset += g->width * g->rows;
+            }
+        }
+    }
+
+    if ((ferror(f) | fclose(f)) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "Warning: couldn't write glyph cache %s\n", path);
+        remove(tmp);
+        return;
+    }
+    font->cached_glyphs = font->num_glyphs;
+}
+
+void
+_Console_free_font (Console_Font *font)
+{
+    _Console_save_font_cache(font);
+    _Console_destroy_glyphs(font);
+    if (font->map)
+        munmap(font->map, font->map_len);
+    if (font->face)
+        FT_Done_Face(font->face);
+    if (font->ft)
+        FT_Done_FreeType(font->ft);
+    free(font->cache_path);
+    free(font->path);
+    free(font);
+}
+
+/*
+ * Open the font at `path' at a pixel size of `size' and render the printable
+ * ASCII glyphs ahead of time, as distance fields if `sdf' is set. With a
+ * cache file all of that comes from the file instead. Nothing here touches
+ * the console so fonts can be loaded on another thread.
+ * Returns NULL on error with the reason written to `err'.
+ */
+Console_Font*
+_Console_load_font (const char *path, int size, bool sdf,
+        char *err, size_t err_len)
+{
+    Console_Font *font;
+    FT_Face face;
+    FT_Error e;
+    Uint32 c;
+
+    font = calloc(1, sizeof(*font));
+    if (!font || !(font->path = strdup(path))) {
+        snprintf(err, err_len, "Not enough memory to load font!");
+        free(font);
+        return NULL;
+    }
+    font->sdf = sdf;
+    font->font_size = size;
+    /* the font keeps the directory it was loaded with */
+    font->cache_path = _Console_copy_cache_path();
+
+    if (_Console_load_font_cache(font) == 0)
+        return font;
+
+    if (_Console_open_face(font, err, err_len))
+        goto error;
+
+    face = font->face;
+
+    if ((e = FT_Load_Glyph(face, FT_Get_Char_Index(face, 'm'), 
+                    FT_LOAD_RENDER))) {
+        snprintf(err, err_len, "Loading glyphs failed: %s", FT_GetError(e));
+        goto error;
+    }
+
+    /* `>> 6' adjusts values which are based at 1/64th of screen pixel size */
+    font->advance = (face->glyph->metrics.horiAdvance >> 6);
+    font->char_width = 
+        (face->glyph->metrics.horiBearingX + face->glyph->metrics.width) >> 6;
+    font->line_height = 
+          (FT_MulFix(face->ascender, face->size->metrics.y_scale) >> 6)
+        - (FT_MulFix(face->descender, face->size->metrics.y_scale) >> 6)
+        + 1;
+    font->baseline = abs(face->descender) * size / face->units_per_EM;
+
+    for (c = ' '; c <= '~'; c++)
+        _Console_get_glyph(font, c);
+
+    _Console_save_font_cache(font);
+    return font;
+
+error:
+    _Console_free_font(font);
+    return NULL;
+}
+
+/*
+ * Find a font that has already been loaded.
+ */
+Console_Font*
+_Console_find_font (Console_tty *tty, const char *path, int size, bool sdf)
+{
+    Console_Font *font;
+    for (font = tty->fonts; font != NULL; font = font->next)
+        if (font->font_size == size && font->sdf == sdf &&
+            strcmp(font->path, path) == 0)
+            return font;
+    return NULL;
+}
+
+void
+_Console_destroy_ft (Console_tty *tty)
+{
+    assert(tty);
+    Console_Font *font, *next;
+
+    if (tty->font_load) {
+        SDL_WaitThread(tty->font_load->thread, NULL);
+        if (tty->font_load->font)
+            _Console_free_font(tty->font_load->font);
+        free(tty->font_load->path);
+        free(tty->font_load);
+        tty->font_load = NULL;
+    }
+
+    for (font = tty->fonts; font != NULL; font = next) {
+        next = font->next;
+        _Console_free_font(font);
+    }
+    tty->fonts = NULL;
+    tty->font = NULL;
+    free(tty->want_font_path);
+    tty->want_font_path = NULL;
+}
+
+/*
+ * Initialize the font. Later fonts are loaded in the background by
+ * Console_SetFont.
+ */
+int
+_Console_init_ft (Console_tty* tty, const char *font_path, const int font_size)
+{
+    assert(tty);
+    char err[256];
+
+    tty->fonts = NULL;
+    tty->font_load = NULL;
+    tty->want_font_path = NULL;
+    tty->base_font_size = font_size;
+
+    tty->font = _Console_load_font(font_path, font_size, false, 
+            err, sizeof(err));
+    if (!tty->font) {
+        Console_SetError(err, "");
+        return 1;
+    }
+    tty->fonts = tty->font;
+
+    return 0;
+}
+
+void
+_Console_destroy_gl (Console_tty *tty)
+{
+    assert(tty);
+    _Console_evict_all_textures(tty);
+    glDeleteShader(tty->vert_shader);
+    glDeleteShader(tty->frag_shader);
+    glDeleteProgram(tty->shader_prog);
+	glDeleteBuffers(1, &tty->VBO);
+	glDeleteVertexArrays(1, &tty->VAO);
+    _Console_destroy_grid(tty);
+    free(tty->batch.vertices);
+    free(tty->batch.draws);
+    tty->batch = (Console_Batch) { 0 };
+}
+
+/*
+ * Get the window's size and all the vars that are associated with the window
+ * size.
+ */
+void
+_Console_set_window_size (Console_tty *tty)
+{
+    assert(tty);
+    Uint64 trace = _Console_trace_begin(tty);
+
+    /* headless consoles are given their size */
+    if (tty->window)
+        SDL_GetWindowSize(tty->window, &tty->window_width,
+                &tty->window_height);
+    tty->cell_width = tty->font->char_width;
+    tty->cell_height = tty->font->line_height;
+    if (tty->font->sdf) {
+        GLfloat scale = (GLfloat)tty->sdf_size / tty->font->font_size;
+        tty->cell_width *= scale;
+        tty->cell_height *= scale;
+    }
+    /* wrap len needs to be updated before updating textures */
+    tty->wrap_len = roundf((float)tty->window_width / tty->cell_width);
+
+    /* the rest is done once GL is set up */
+    if (!tty->gl_ready) {
+        _Console_trace_end(tty, "_Console_set_window_size", trace);
+        return;
+    }
+
+    _Console_gl_begin(tty);
+    _Console_gl_set(tty, CONSOLE_GL_PROGRAM, tty->shader_prog);
+    glViewport(0, 0, tty->window_width, tty->window_height);
+
+    /* 
+     * Setup 2D projection matrix for vertex shader.
+     * left, right, bottom, top
+     */
+    GLfloat l = 0.0f;
+    GLfloat r = (GLfloat)tty->window_width;
+    GLfloat b = 0.0f;
+    GLfloat t = (GLfloat)tty->window_height;
+    GLfloat orthoMatrix[4*4] = {
+        2.0f / (r - l),   0.0f,             0.0f, 0.0f,
+        0.0f,             2.0f / (t - b),   0.0f, 0.0f,
+        0.0f,             0.0f,            -1.0f, 0.0f,
+        -(r + l)/(r - l), -(t + b)/(t - b), 0.0f, 1.0f,
+    };
+    glUniformMatrix4fv(tty->projection_loc, 1, GL_FALSE, orthoMatrix);
+
+    if (_Console_m_uses_grid(tty)) {
+        _Console_grid_resize(tty);
+        tty->rebuild_textures = true;
+    } else {
+        /* lines are rasterized at the new size as they're drawn */
+        _Console_evict_all_textures(tty);
+        tty->rebuild_line = true;
+    }
+
+    _Console_gl_end(tty);
+    _Console_trace_end(tty, "_Console_set_window_size", trace);
+}
+
+/*
+ * Switch to a loaded font. Everything is laid out again for the new size.
+ */
+void
+_Console_use_font (Console_tty *tty, Console_Font *font)
+{
+    /* scaling a distance field font needs no new glyphs */
+    if (font != tty->font) {
+        tty->font = font;
+        if (tty->grid.program != 0)
+            _Console_grid_reset_atlas(tty);
+    }
+    _Console_set_window_size(tty);
+    tty->rebuild_line = true;
+}
+
+int
+_Console_font_load_thread (void *data)
+{
+    Console_FontLoad *fl = data;
+    fl->font = _Console_load_font(fl->path, fl->size, fl->sdf,
+            fl->error, sizeof(fl->error));
+    SDL_AtomicSet(&fl->done, 1);
+    return 0;
+}
+
+/*
+ * Called every frame to switch to the font asked for by Console_SetFont. A
+ * font that has been used before is switched to right away, otherwise it is
+ * loaded on another thread while the current font stays on screen. Distance
+ * field fonts are only loaded at their reference size and scaled.
+ */
+void
+_Console_update_font (Console_tty *tty)
+{
+    Console_FontLoad *fl = tty->font_load;
+    Console_Font *font;
+    bool sdf = tty->render_mode == CONSOLE_RENDER_SDF;
+    int size;
+
+    if (fl && SDL_AtomicGet(&fl->done)) {
+        SDL_WaitThread(fl->thread, NULL);
+        if (fl->font) {
+            fl->font->next = tty->fonts;
+            tty->fonts = fl->font;
+        } else {
+            fprintf(stderr, "Warning: font could not be loaded: %s\n",
+                    fl->error);
+            /* don't try again if it's still the font asked for */
+            if (tty->want_font_path && 
+                    strcmp(tty->want_font_path, fl->path) == 0) {
+                free(tty->want_font_path);
+                tty->want_font_path = NULL;
+            }
+        }
+        free(fl->path);
+        free(fl);
+        tty->font_load = fl = NULL;
+    }
+
+    if (!tty->want_font_path)
+        return;
+
+    size = sdf ? CONSOLE_SDF_SIZE : tty->want_font_size;
+    font = _Console_find_font(tty, tty->want_font_path, size, sdf);
+    if (font) {
+        free(tty->want_font_path);
+        tty->want_font_path = NULL;
+        if (font != tty->font || (sdf && tty->sdf_size != tty->want_font_size)) {
+            tty->sdf_size = tty->want_font_size;
+            _Console_use_font(tty, font);
+        }
+        return;
+    }
+
+    /* one load at a time, the latest font asked for is loaded next */
+    if (fl)
+        return;
+
+    fl = calloc(1, sizeof(*fl));
+    if (!fl || !(fl->path = strdup(tty->want_font_path))) {
+        free(fl);
+        return;
+    }
+    fl->size = size;
+    fl->sdf = sdf;
+    SDL_AtomicSet(&fl->done, 0);
+    fl->thread = SDL_CreateThread(_Console_font_load_thread, "Console font",
+            fl);
+    if (!fl->thread) {
+        fprintf(stderr, "Warning: font thread could not be created: %s\n",
+                SDL_GetError());
+        free(fl->path);
+        free(fl);
+        return;
+    }
+    tty->font_load = fl;
+}
+
+/*
+ * Load all of the OpenGL specific aspects of the tty. The only thing it
+ * doesn't handle is the texture of each line (made the first time the line is
+ * rasterized) which _Console_destroy_gl also cleans up.
+ */
+int
+_Console_init_gl (Console_tty *tty, SDL_Window *window)
+{
+    assert(tty);
+    assert(window);
+
+    GLuint VAO;
+    GLuint VBO;
+    GLuint shader_prog;
+
+    GLint  posAttrib;
+    GLint  colorAttrib;
+    GLint  modeAttrib;
+
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
+            SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+    /*SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);*/
+
+    glGenVertexArrays(1, &VAO);
+	glGenBuffers(1, &VBO);
+
+    /* setup values so they can be used to in destroy function if needed */
+    tty->VAO = VAO;
+    tty->VBO = VBO;
+    tty->window      = window;
+
+    /* compile and link the shaders, or load the program from the cache */
+    if (_Console_build_program(_Console_vertex_source, _Console_frag_source,
+                &tty->shader_prog, &tty->vert_shader, &tty->frag_shader)) {
+        _Console_destroy_gl(tty);
+        return 1;
+    }
+    shader_prog = tty->shader_prog;
+
+    glUseProgram(tty->shader_prog);
+
+    /* Setup the buffer and attribute buffers so we can set values */
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    /* the buffer is sized as the batches need it */
+    tty->batch.vbo_size = 0;
+
+    /* set the offsets of the position, color and mode in the buffer */
+    posAttrib = glGetAttribLocation(shader_prog, "vertex");
+    glVertexAttribPointer(posAttrib, 4, GL_FLOAT, GL_FALSE, 
+            sizeof(Console_Vertex), (void*)offsetof(Console_Vertex, x));
+    glEnableVertexAttribArray(posAttrib);
+
+    colorAttrib = glGetAttribLocation(shader_prog, "color");
+    glVertexAttribPointer(colorAttrib, 4, GL_FLOAT, GL_FALSE, 
+            sizeof(Console_Vertex), (void*)offsetof(Console_Vertex, r));
+    glEnableVertexAttribArray(colorAttrib);
+
+    modeAttrib = glGetAttribLocation(shader_prog, "mode");
+    glVertexAttribPointer(modeAttrib, 1, GL_FLOAT, GL_FALSE, 
+            sizeof(Console_Vertex), (void*)offsetof(Console_Vertex, mode));
+    glEnableVertexAttribArray(modeAttrib);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    /* Cache uniform locations */
+    tty->projection_loc = glGetUniformLocation(shader_prog, "projection");
+    glUseProgram(0);
+
+    return 0;
+}
+
+/*
+ * Create the GL resources if they haven't been yet. This is put off until
+ * the console is first drawn, or Console_WarmUp, so programs that never open
+ * the console don't pay for it. Both run where the window's GL context is
+ * current, which event watches may not be. Lines written until then are
+ * rasterized now.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+_Console_warm_up (Console_tty *tty)
+{
+    if (tty->gl_ready || tty->headless)
+        return 0;
+
+    if (_Console_init_gl(tty, tty->window))
+        return 1;
+    if (tty->render_mode != CONSOLE_RENDER_LINES && _Console_init_grid(tty)) {
+        _Console_destroy_gl(tty);
+        return 1;
+    }
+    tty->gl_ready = true;
+
+    _Console_set_window_size(tty);
+    tty->rebuild_line = true;
+    return 0;
+}
+
+/*
+ * Inserts string `c' into the given text array. This will increase the text's
+ * length by then of `c'.
+ * Returns 1 if inserting will be past max, else inserts char and returns 0.
+ * Expects len to be zero-indexed length of text array.
+ */
+int
+_Console_insert_text (char *text, const char *c, int index, int max, int *len)
+{
+    int c_len = strlen(c);
+    int i;
+    if (*len + c_len > max)
+        return 1;
+    for (i = *len; i >= index; i--)
+        text[i + c_len] = text[i];
+    for (i = 0; i < c_len; i++)
+        text[index + i] = c[i];
+    *len += c_len;
+    return 0;
+}
+
+/*
+ * Handle inserting input depending on where the cursor is within the current
+ * line.
+ */
+void
+_Console_get_input (Console_tty *tty, const char *input)
+{
+    assert(tty);
+    assert(input);
+
+    int input_length = strlen(input);
+    if (tty->curr_line->len + input_length >= tty->max_input)
+        return;
+
+    /* typing brings the view back down to the line being typed */
+    if (tty->scroll > 0) {
+        tty->scroll = 0;
+        tty->grid.rebuild = true;
+    }
+
+    /* if cursor is at end of line, it's a simple concatenation */
+    if (tty->cursor == tty->curr_line->len) {
+        strncat(tty->curr_line->input, input, input_length);
+        tty->curr_line->len += input_length;
+    } else {
+    /* else insert text into line at cursor's index */
+        _Console_insert_text(tty->curr_line->input, input, tty->cursor,
+                tty->max_input, &tty->curr_line->len);
+    }
+    tty->cursor += input_length;
+    tty->rebuild_line = true;
+}
+
+/* 
+ * Shifts a text left, removing `n' bytes from the text array at `index'. Text
+ * array must have a length of at least `n'. This will decrement the length of
+ * the array by `n'.
+ */
+int
+_Console_shift_text (char *text, int index, int n, int *len)
+{
+    int i;
+    if (*len < n)
+        return 1;
+    for (i = index; i < *len - n; i++)
+        text[i] = text[i + n];
+    *len -= n;
+    text[*len] = '\0';
+    return 0;
+}
+
+/*
+ * The number of bytes of the UTF-8 character which ends just before `index'.
+ */
+int
+_Console_prev_char_len (const char *text, int index)
+{
+    int i = index - 1;
+    while (i > 0 && ((unsigned char)text[i] & 0xC0) == 0x80)
+        i--;
+    return index - i;
+}
+
+/*
+ * The number of bytes of the UTF-8 character starting at `index'.
+ */
+int
+_Console_next_char_len (const char *text, int index, int len)
+{
+    int i = index + 1;
+    while (i < len && ((unsigned char)text[i] & 0xC0) == 0x80)
+        i++;
+    return i - index;
+}
+
+/*
+ * Handle removing input with backspace or delete. We currenty only remove 
+ * input one character at a time, unlike inserting input. A character may be
+ * several bytes of UTF-8.
+ */
+void
+_Console_remove_input (Console_tty *tty)
+{
+    assert(tty);
+    int n;
+
+    if (tty->cursor == 0 || tty->curr_line->len == 0)
+        return;
+
+    n = _Console_prev_char_len(tty->curr_line->input, tty->cursor);
+
+    /* if cursor is at end of line just mark end of line at cursor */
+    if (tty->curr_line->len == tty->cursor) {
+        tty->curr_line->len -= n;
+        tty->cursor -= n;
+        tty->curr_line->input[tty->cursor] = '\0';
+    } else {
+    /* else shift the text from cursor left by one character */
+        tty->cursor -= n;
+        _Console_shift_text(tty->curr_line->input, tty->cursor, n,
+                &tty->curr_line->len);
+    }
+    tty->rebuild_line = true;
+}
+
+/*
+ * Change the font and its size. Fonts that have been used before are switched
+ * to on the next frame. New fonts are loaded in the background and the
+ * current font is used until they are ready.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFont (Console_tty *tty, const char *font_path, int font_size)
+{
+    assert(tty);
+    assert(font_path);
+    char *path;
+
+    if (font_size < CONSOLE_MIN_FONT_SIZE)
+        font_size = CONSOLE_MIN_FONT_SIZE;
+
+    path = strdup(font_path);
+    if (!path) {
+        Console_SetError("Not enough memory to set font!", "");
+        return 1;
+    }
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        free(path);
+        return 1;
+    }
+    free(tty->want_font_path);
+    tty->want_font_path = path;
+    tty->want_font_size = font_size;
+    SDL_UnlockMutex(tty->mutex);
+
+    return 0;
+}
+
+/*
+ * Change the size of the current font, see Console_SetFont.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFontSize (Console_tty *tty, int font_size)
+{
+    assert(tty);
+    int ret;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+    ret = Console_SetFont(tty, tty->want_font_path ? tty->want_font_path : 
+            tty->font->path, font_size);
+    SDL_UnlockMutex(tty->mutex);
+
+    return ret;
+}
+
+/*
+ * Get the size of the font asked for last, which may still be loading.
+ */
+int
+Console_GetFontSize (Console_tty *tty)
+{
+    assert(tty);
+    if (tty->want_font_path)
+        return tty->want_font_size;
+    return tty->font->sdf ? tty->sdf_size : tty->font->font_size;
+}
+
+int
+Console_InputWatch (void *data, SDL_Event *e)
+{
+    assert(data);
+    Console_tty *tty = data;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        tty->failed = true;
+        return 0;
+    }
+
+    /* headless consoles have no trigger watch to record events */
+    if (tty->headless)
+        _Console_record_event(tty, e);
+
+    if (!tty->status)
+        goto unlock;
+
+    switch (e->type) {
+    case SDL_KEYDOWN:
+        switch (e->key.keysym.sym) {
+        case SDLK_BACKSPACE:
+            _Console_remove_input(tty);
+            if (tty->filter_line)
+                _Console_filter_changed(tty);
+            break;
+
+        case SDLK_RETURN:
+            if (tty->filter_line)
+                _Console_end_filter(tty);
+            else if (Console_NewLine(tty, tty->input_func,
+                        tty->input_func_data))
+                tty->failed = true;
+            break;
+
+        /* filter the lines */
+        case SDLK_f:
+            if (e->key.keysym.mod & KMOD_CTRL) {
+                if (tty->filter_line)
+                    _Console_end_filter(tty);
+                else
+                    _Console_begin_filter(tty);
+            }
+            break;
+
+        /* scroll by a page, pulling more output at the bottom */
+        case SDLK_PAGEUP:
+            if (_Console_scroll(tty, _Console_page_rows(tty) - 1))
+                tty->failed = true;
+            break;
+
+        case SDLK_PAGEDOWN:
+            if (_Console_scroll(tty, 1 - _Console_page_rows(tty)))
+                tty->failed = true;
+            break;
+
+        /* copy */
+        case SDLK_c:
+            if (e->key.keysym.mod & KMOD_CTRL) {
+                /* SDL_SetClipboardText(tty->curr_line->input) */
+            }
+            break;
+
+        /* paste */
+        case SDLK_v:
+            if (e->key.keysym.mod & KMOD_CTRL) {
+                /* Console_GetInput(tty, SDL_GetClipboardText()); */
+            }
+            break;
+
+        /* zoom */
+        case SDLK_EQUALS:
+        case SDLK_PLUS:
+        case SDLK_KP_PLUS:
+            if (e->key.keysym.mod & KMOD_CTRL)
+                Console_SetFontSize(tty, Console_GetFontSize(tty) +
+                        CONSOLE_ZOOM_STEP);
+            break;
+
+        case SDLK_MINUS:
+        case SDLK_KP_MINUS:
+            if (e->key.keysym.mod & KMOD_CTRL)
+                Console_SetFontSize(tty, Console_GetFontSize(tty) -
+                        CONSOLE_ZOOM_STEP);
+            break;
+
+        case SDLK_0:
+            if (e->key.keysym.mod & KMOD_CTRL)
+                Console_SetFontSize(tty, tty->base_font_size);
+            break;
+
+        case SDLK_UP:
+            Console_SetCurrLine(tty, LINE_UP);
+            break;
+
+        case SDLK_DOWN:
+            Console_SetCurrLine(tty, LINE_DOWN);
+            break;
+
+        case SDLK_LEFT:
+            if (tty->cursor > 0) {
+                tty->cursor -= _Console_prev_char_len(
+                        tty->curr_line->input, tty->cursor);
+                tty->rebuild_line = true;
+            }
+            break;
+
+        case SDLK_RIGHT:
+            if (tty->cursor < tty->max_input && 
+                    tty->cursor < tty->curr_line->len) {
+                tty->cursor += _Console_next_char_len(
+                        tty->curr_line->input, tty->cursor, 
+                        tty->curr_line->len);
+                tty->rebuild_line = true;
+            }
+            break;
+        }
+        break;
+
+    case SDL_TEXTINPUT:
+        _Console_get_input(tty, e->text.text);
+        if (tty->filter_line)
+            _Console_filter_changed(tty);
+        break;
+    }
+
+unlock:
+    SDL_UnlockMutex(tty->mutex);
+    return 0;
+}
+
+/*
+ * Watch for the trigger to toggle having the console displayed and handling
+ * input or off and not handling input.
+ */
+int
+Console_TriggerWatch (void *data, SDL_Event *e)
+{
+    assert(data);
+    Console_tty *tty = data;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        tty->failed = true;
+        return 0;
+    }
+
+    _Console_record_event(tty, e);
+
+    /* watch for window size changes to update our console behind-the-scenes */
+    if (e->type == SDL_WINDOWEVENT && 
+        e->window.event == SDL_WINDOWEVENT_RESIZED) {
+        _Console_set_window_size(tty);
+    }
+
+    if (e->type == SDL_KEYDOWN && e->key.keysym.sym == tty->trigger_key) {
+        if (tty->status) {
+            SDL_DelEventWatch(Console_InputWatch, tty);
+            SDL_StopTextInput();
+            tty->status = false;
+        } else {
+            SDL_StartTextInput();
+            SDL_AddEventWatch(Console_InputWatch, tty);
+            tty->status = true;
+        }
+    }
+
+    SDL_UnlockMutex(tty->mutex);
+    return 0; /* return is ignored */
+}
+
+/*
+ * Read a varint of the recording into `v'.
+ * Returns 1 if the recording ends first, 0 otherwise.
+ */
+int
+_Console_replay_varint (Console_Playback *r, Uint64 *v)
+{
+    int shift = 0;
+    unsigned char b;
+
+    *v = 0;
+    do {
+        if (r->pos == r->len || shift > 63)
+            return 1;
+        b = r->data[r->pos++];
+        *v |= (Uint64)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return 0;
+}
+
+/*
+ * Read the type and time of the next record.
+ * Returns 1 at the end of the recording, 0 otherwise.
+ */
+int
+_Console_replay_record (Console_Playback *r, int *type)
+{
+    Uint64 delta;
+
+    if (r->pos == r->len)
+        return 1;
+    *type = r->data[r->pos++];
+    if (_Console_replay_varint(r, &delta))
+        return 1;
+    r->time += delta;
+    return 0;
+}
+
+/*
+ * Read the next record, which has to be output of `type', copying its text
+ * to `text' if it has any.
+ * Returns the record's flags, or -1 if the replay went differently from the
+ * recording.
+ */
+int
+_Console_replay_output (Console_Playback *r, int type, char **text)
+{
+    int t, flags;
+    Uint64 len;
+
+    *text = NULL;
+    if (_Console_replay_record(r, &t) || t != type || r->pos == r->len)
+        return -1;
+    flags = r->data[r->pos++];
+    if (_Console_replay_varint(r, &len) || len > r->len - r->pos)
+        return -1;
+    if (flags & CONSOLE_REC_HAS_TEXT) {
+        *text = malloc(len + 1);
+        if (*text) {
+            memcpy(*text, r->data + r->pos, len);
+            (*text)[len] = '\0';
+        }
+    }
+    r->pos += len;
+    return flags;
+}
+
+/*
+ * Generator giving the lines a generator gave while recording.
+ */
+int
+_Console_replay_line (void *data, char **output)
+{
+    int flags = _Console_replay_output(data, CONSOLE_REC_LINE, output);
+    return flags > 0 && (flags & CONSOLE_REC_MORE);
+}
+
+/*
+ * Input function giving the outputs the input function gave while
+ * recording.
+ */
+int
+_Console_replay_input (const char *text, void *data, char **output)
+{
+    int flags = _Console_replay_output(data, CONSOLE_REC_OUTPUT, output);
+
+    if (flags < 0) {
+        Console_SetOutput(output, "replay doesn't match the recording");
+        return 1;
+    }
+    if (flags & CONSOLE_REC_GENERATOR) {
+        free(*output);
+        *output = NULL;
+        Console_SetOutputGenerator(output, _Console_replay_line, NULL, data);
+    }
+    return (flags & CONSOLE_REC_FAILED) ? 1 : 0;
+}
+
+/*
+ * Pass an event to the console the way SDL would.
+ */
+void
+_Console_replay_event (Console_tty *tty, SDL_Event *e)
+{
+    if (!tty->headless)
+        Console_TriggerWatch(tty, e);
+    if (tty->status)
+        Console_InputWatch(tty, e);
+}
+
+/*
+ * Keep glyph cache files in `dir', or stop using them if `dir' is NULL.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetCachePath (const char *dir)
+{
+    char *path = NULL, *old;
+
+    if (dir && !(path = strdup(dir))) {
+        Console_SetError("Not enough memory to set cache path!", "");
+        return 1;
+    }
+    /* fonts being loaded have their own copy of the old one */
+    SDL_AtomicLock(&_Console_cache_lock);
+    old = _Console_cache_path;
+    _Console_cache_path = path;
+    SDL_AtomicUnlock(&_Console_cache_lock);
+    free(old);
+    return 0;
+}
+
+/*
+ * Create the console. 
+ * The console will load the font at `font_path'. The font path *must* be a
+ * monospaced or fixed-width. 
+ * The `trigger_key' is the keyboard key that toggles the console on and off.
+ * `input_func' is the function that uses the input to the console and 
+ * `input_func_data' is userdata given to that function.
+ * Returns NULL on error.
+ */
+Console_tty*
+_Console_create (SDL_Window *window,
+                 int width,
+                 int height,
+                 const char *font_path,
+                 const int font_size,
+                 SDL_Keycode trigger_key,
+                 Console_InputFunction input_func,
+                 void *input_func_data)
+{
+    Console_tty *tty = malloc(sizeof(*tty));
+
+    if (!tty) {
+        Console_SetError("Not enough memory to create console!", "");
+        goto exit;
+    }
+
+    tty->window       = NULL;
+    tty->lines_head   = NULL;
+    tty->lines_tail   = NULL;
+    tty->curr_line    = NULL;
+    tty->saved_line   = NULL;
+    tty->rebuild_line = true;
+    tty->cursor       = 0;
+    tty->status       = false;
+    tty->prompt       = DEFAULT_PROMPT;
+    tty->prompt_len   = DEFAULT_PROMPT_LEN;
+    tty->max_lines    = DEFAULT_LINE_LENGTH;
+    tty->max_input    = DEFAULT_LINE_CHARS;
+    tty->trigger_key  = trigger_key;
+    tty->input_func   = input_func;
+    tty->input_func_data = input_func_data;
+    tty->bg_color     = (Console_Color) { 0.0f, 0.0f, 0.0f, 0.9f };
+    tty->font_color   = (Console_Color) { 1.0f, 1.0f, 1.0f, 1.0f };
+    tty->gl_state.depth   = 0;
+    tty->gl_state.touched = 0;
+    tty->gl_state.known   = 0;
+    tty->gl_state.restore = false;
+    tty->batch = (Console_Batch) { 0 };
+    tty->grid  = (Console_Grid) { 0 };
+    tty->render_mode = CONSOLE_RENDER_LINES;
+    tty->rebuild_textures = false;
+    tty->gl_ready = false;
+    tty->window = window;
+    tty->headless = window == NULL;
+    tty->frame = NULL;
+    tty->frame_width = 0;
+    tty->frame_height = 0;
+    memset(&tty->stats, 0, sizeof(tty->stats));
+    memset(&tty->stats_frame, 0, sizeof(tty->stats_frame));
+    memset(&tty->stats_total, 0, sizeof(tty->stats_total));
+    tty->stats_frames = 0;
+    tty->stats_glyphs = 0;
+    tty->trace = NULL;
+    tty->record = NULL;
+    tty->record_last = 0;
+    tty->replaying = false;
+    tty->remote = NULL;
+    tty->log = NULL;
+    tty->exec_file = NULL;
+    tty->exec_depth = 0;
+    tty->in_command = false;
+    tty->in_generator = false;
+    tty->failed = false;
+    tty->window_width = width;
+    tty->window_height = height;
+    tty->pool_len = 0;
+    tty->texture_bytes = 0;
+    tty->gpu_budget = 0;
+    tty->scroll = 0;
+    tty->filter_line = NULL;
+    tty->filter_gen = 1;
+    tty->filter_changed = false;
+    tty->generator = NULL;
+    tty->generator_finish = NULL;
+    tty->generator_state = NULL;
+    tty->collapse_repeats = false;
+    tty->frame_time_next = 0;
+    tty->num_frame_times = 0;
+    tty->frame_times_given = false;
+    tty->last_draw = 0;
+    tty->frame_graph = false;
+    tty->builtins = false;
+    tty->intern_output = false;
+    memset(tty->interned, 0, sizeof(tty->interned));
+
+    tty->mutex = SDL_CreateMutex();
+    if (!tty->mutex) {
+        Console_SetError("Failed to create mutex: ", SDL_GetError());
+        free(tty);
+        tty = NULL;
+        goto exit;
+    }
+
+    /*
+     * TODO: Nearly Done. This is the final stretch:
+     *   - handle background color
+     *   - handle text color
+     */
+
+    if (_Console_init_ft(tty, font_path, font_size)) {
+        free(tty);
+        tty = NULL;
+        goto exit;
+    }
+
+    /* GL is set up by _Console_warm_up */
+    if (_Console_create_line(tty)) {
+        _Console_destroy_ft(tty);
+        free(tty);
+        tty = NULL;
+        goto exit;
+    }
+
+    /* lines are laid out for the window from the start */
+    _Console_set_window_size(tty);
+
+    /* headless consoles are always open */
+    if (tty->headless) {
+        tty->status = true;
+        SDL_AddEventWatch(Console_InputWatch, tty);
+    } else {
+        SDL_AddEventWatch(Console_TriggerWatch, tty);
+    }
+
+exit:
+    return tty;
+}
+
+/*
+ * Create the console.
+ */
+Console_tty* 
+Console_Create (SDL_Window *window, 
+                const char *font_path, 
+                const int font_size,
+                SDL_Keycode trigger_key,
+                Console_InputFunction input_func,
+                void *input_func_data)
+{
+    assert(window);
+    return _Console_create(window, 0, 0, font_path, font_size, trigger_key,
+            input_func, input_func_data);
+}
+
+/*
+ * Create a console drawn in software, without a window or GL.
+ */
+Console_tty*
+Console_CreateHeadless (int width,
+                        int height,
+                        const char *font_path,
+                        const int font_size,
+                        Console_InputFunction input_func,
+                        void *input_func_data)
+{
+    if (width <= 0 || height <= 0) {
+        Console_SetError("Headless console needs a size!", "");
+        return NULL;
+    }
+    return _Console_create(NULL, width, height, font_path, font_size,
+            SDLK_UNKNOWN, input_func, input_func_data);
+}
+
+/*
+ * Resize a headless console's frame. Lines are laid out again for the new
+ * size.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFrameSize (Console_tty *tty, int width, int height)
+{
+    assert(tty);
+
+    if (!tty->headless || width <= 0 || height <= 0) {
+        Console_SetError("Only headless consoles can be given a size!", "");
+        return 1;
+    }
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+    tty->window_width = width;
+    tty->window_height = height;
+    _Console_set_window_size(tty);
+    SDL_UnlockMutex(tty->mutex);
+    return 0;
+}
+
+/*
+ * The last frame drawn by a headless console, or NULL if there is none.
+ */
+const unsigned char*
+Console_GetFrame (Console_tty *tty, int *width, int *height)
+{
+    assert(tty);
+    if (width)
+        *width = tty->frame_width;
+    if (height)
+        *height = tty->frame_height;
+    return tty->frame;
+}
+
+/*
+ * Write the last frame of a headless console to `path' as a binary PPM.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SaveFrame (Console_tty *tty, const char *path)
+{
+    assert(tty);
+    FILE *f;
+    int i, n = tty->frame_width * tty->frame_height;
+    bool failed;
+
+    if (!tty->frame) {
+        Console_SetError("No frame has been drawn!", "");
+        return 1;
+    }
+    f = fopen(path, "wb");
+    if (!f) {
+        Console_SetError("Failed to open frame file: ", path);
+        return 1;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", tty->frame_width, tty->frame_height);
+    for (i = 0; i < n; i++)
+        fwrite(tty->frame + i * 4, 1, 3, f);
+    failed = ferror(f) != 0;
+    if (fclose(f) != 0 || failed) {
+        Console_SetError("Failed to write frame file: ", path);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Create the console's GL resources now rather than when it's first drawn.
+ * The window's GL context has to be current.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_WarmUp (Console_tty *tty)
+{
+    assert(tty);
+    int ret;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+    ret = _Console_warm_up(tty);
+    SDL_UnlockMutex(tty->mutex);
+
+    return ret;
+}
+
+/*
+ * Handle drawing the console if it is toggled.
+ * Returns 1 on an error, 0 otherwise.
+ */
+int
+Console_Draw (Console_tty *tty)
+{
+    int ret = 0;
+    Uint64 start, now;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        ret = 1;
+        goto exit;
+    }
+
+    _Console_record(tty, CONSOLE_REC_FRAME);
+
+    /* frames are timed from draw to draw unless the program times them */
+    now = SDL_GetPerformanceCounter();
+    if (!tty->frame_times_given && tty->last_draw != 0)
+        _Console_record_frame_time(tty, (now - tty->last_draw) * 1000.0 /
+                SDL_GetPerformanceFrequency());
+    tty->last_draw = now;
+
+    _Console_update_font(tty);
+
+    /* remote commands are run even while the console is closed */
+    if (tty->remote && _Console_remote_draw(tty))
+        ret = 1;
+
+    if (!tty->status)
+        goto unlock;
+
+    if (tty->headless) {
+        start = CONSOLE_STAT_NOW();
+        if (tty->failed || _Console_render_frame(tty))
+            ret = 1;
+        CONSOLE_STAT_SINCE(tty, render_time, start);
+        _Console_end_frame_stats(tty);
+        goto unlock;
+    }
+
+    if (_Console_warm_up(tty)) {
+        ret = 1;
+        goto unlock;
+    }
+
+    /* if an event watch failed */
+    if (tty->failed) {
+        ret = 1;
+        goto unlock;
+    }
+
+    start = CONSOLE_STAT_NOW();
+    if (Console_Render(tty))
+        ret = 1;
+    CONSOLE_STAT_SINCE(tty, render_time, start);
+    _Console_end_frame_stats(tty);
+
+unlock:
+    SDL_UnlockMutex(tty->mutex);
+exit:
+    return ret;
+}
+
+/*
+ * In the `input_func`, this function handles memory for output and should
+ * be used instead of malloc, realloc, etc.
+ */
+void
+Console_SetOutput (char **out, const char *s)
+{
+    *out = strdup(s);
+}
+
+/*
+ * In the `input_func`, show `len' bytes at `text' as the output without
+ * copying them. `release' is called with `text' and `release_data' once the
+ * console is done with it, and may be NULL for text that outlives the console.
+ * An output the console didn't pass in gets a copy like Console_SetOutput.
+ */
+void
+Console_SetOutputView (char **out,
+                       const char *text,
+                       size_t len,
+                       Console_ReleaseFunction release,
+                       void *release_data)
+{
+    Console_Output *o = _Console_find_output(out);
+
+    if (!o) {
+        *out = malloc(len + 1);
+        if (*out) {
+            memcpy(*out, text, len);
+            (*out)[len] = '\0';
+        }
+        if (release)
+            release(text, release_data);
+        return;
+    }
+    if (o->view && o->release)
+        o->release(o->view, o->release_data);
+    o->view = text;
+    o->len = len;
+    o->release = release;
+    o->release_data = release_data;
+}
+
+/*
+ * In the `input_func`, have the output pulled from `next' a line at a time as
+ * it's shown. `finish' is called with `state' once it's no longer needed,
+ * straight away for an output the console didn't pass in.
+ */
+void
+Console_SetOutputGenerator (char **out,
+                            Console_GeneratorFunction next,
+                            Console_FinishFunction finish,
+                            void *state)
+{
+    Console_Output *o = _Console_find_output(out);
+
+    /* outside the console nothing would ever pull the lines */
+    if (!o) {
+        if (finish)
+            finish(state);
+        return;
+    }
+    if (o->generator && o->generator_finish)
+        o->generator_finish(o->generator_state);
+    o->generator = next;
+    o->generator_finish = finish;
+    o->generator_state = state;
+}
+
+/*
+ * Set the background color of the console.
+ * Default is 0.0f, 0.0f, 0.0f, 0.90f.
+ */
+void
+Console_SetBackgroundColor (Console_tty *tty, Console_Color c)
+{
+    tty->bg_color = c;
+}
+
+/*
+ * Handle drawing the console if it is toggled.
+ * Returns 1 on an error, 0 otherwise.
+ */
+void
+Console_SetFontColor (Console_tty *tty, Console_Color c)
+{
+    tty->font_color = c;
+}
+
+/*
+ * Get the current font for render mode `mode': a distance field font at the
+ * reference size or the font rasterized at the size shown. Fonts that haven't
+ * been used yet are loaded right away.
+ * Returns NULL on error.
+ */
+Console_Font*
+_Console_font_for_mode (Console_tty *tty, Console_RenderMode mode)
+{
+    bool sdf = mode == CONSOLE_RENDER_SDF;
+    int size = sdf ? CONSOLE_SDF_SIZE : tty->sdf_size;
+    Console_Font *font;
+    char err[256];
+
+#ifndef CONSOLE_HAVE_SDF
+    if (sdf) {
+        Console_SetError("Distance field glyphs need FreeType 2.11!", "");
+        return NULL;
+    }
+#endif
+
+    font = _Console_find_font(tty, tty->font->path, size, sdf);
+    if (font)
+        return font;
+
+    font = _Console_load_font(tty->font->path, size, sdf, err, sizeof(err));
+    if (!font) {
+        Console_SetError(err, "");
+        return NULL;
+    }
+    font->next = tty->fonts;
+    tty->fonts = font;
+    return font;
+}
+
+/*
+ * Switch how the console is rendered. The grid renderer is created the first
+ * time it is used. Switching back to lines rebuilds any line textures that
+ * were skipped while the grid was in use.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetRenderMode (Console_tty *tty, Console_RenderMode mode)
+{
+    assert(tty);
+    int ret = 0;
+    Console_Font *prev_font;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+
+    if (mode == tty->render_mode)
+        goto unlock;
+
+    /* the software renderer only draws lines */
+    if (tty->headless) {
+        Console_SetError("Headless consoles only render lines!", "");
+        ret = 1;
+        goto unlock;
+    }
+
+    prev_font = tty->font;
+    /* distance field fonts are separate from the ones rasterized per size */
+    if ((mode == CONSOLE_RENDER_SDF) != tty->font->sdf) {
+        Console_Font *font = _Console_font_for_mode(tty, mode);
+        if (!font) {
+            ret = 1;
+            goto unlock;
+        }
+        if (mode == CONSOLE_RENDER_SDF)
+            tty->sdf_size = tty->font->font_size;
+        tty->font = font;
+        if (tty->grid.program != 0 && _Console_grid_reset_atlas(tty)) {
+            ret = 1;
+            goto unlock;
+        }
+    }
+
+    /* the renderer is set up with the rest of GL */
+    if (!tty->gl_ready) {
+        tty->render_mode = mode;
+        _Console_set_window_size(tty);
+        goto unlock;
+    }
+
+    if (mode != CONSOLE_RENDER_LINES) {
+        if (tty->grid.program == 0 && _Console_init_grid(tty)) {
+            tty->font = prev_font;
+            ret = 1;
+            goto unlock;
+        }
+        tty->render_mode = mode;
+        _Console_set_window_size(tty);
+    } else {
+        tty->render_mode = mode;
+        /* this has every line rasterized again */
+        _Console_set_window_size(tty);
+        tty->rebuild_textures = false;
+        tty->rebuild_line = true;
+    }
+
+unlock:
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
+
+/*
+ * Limit the GPU memory the console uses to about `bytes', 0 for no limit.
+ * Past the limit the textures of lines scrolled off screen are dropped and
+ * rasterized again when they're next shown.
+ */
+void
+Console_SetGPUBudget (Console_tty *tty, size_t bytes)
+{
+    assert(tty);
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    tty->gpu_budget = bytes;
+    if (tty->gl_ready) {
+        _Console_gl_begin(tty);
+        _Console_trim_textures(tty);
+        _Console_gl_end(tty);
+    }
+    SDL_UnlockMutex(tty->mutex);
+}
+
+/*
+ * Keep at most `lines' lines, the one being typed included. The oldest lines
+ * are dropped when there are more.
+ */
+int
+Console_SetScrollback (Console_tty *tty, int lines)
+{
+    assert(tty);
+    Console_Line *line;
+
+    if (lines < 2) {
+        Console_SetError("Scrollback needs at least 2 lines!", "");
+        return 1;
+    }
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+
+    tty->max_lines = lines;
+    _Console_gl_begin(tty);
+    while (tty->num_lines > tty->max_lines) {
+        line = tty->lines_tail;
+        if (line == tty->curr_line) {
+            tty->curr_line = tty->lines_head;
+            tty->cursor = tty->curr_line->len;
+            tty->rebuild_line = true;
+        }
+        if (line == tty->saved_line)
+            tty->saved_line = NULL;
+        tty->lines_tail = line->prev;
+        tty->lines_tail->next = NULL;
+        _Console_evict_texture(tty, line);
+        _Console_free_output(tty, line);
+        free(line->input);
+        free(line->spans);
+        free(line);
+        tty->num_lines--;
+    }
+    _Console_gl_end(tty);
+    tty->grid.rebuild = true;
+
+    SDL_UnlockMutex(tty->mutex);
+    return 0;
+}
+
+/*
+ * Let lines hold up to `chars' bytes of input, the terminating NUL included.
+ * Lines longer than that are cut at the last whole character that fits.
+ */
+int
+Console_SetLineLength (Console_tty *tty, int chars)
+{
+    assert(tty);
+    Console_Line *line;
+    char *input;
+    int len;
+
+    /* room for a character of any length and the NUL */
+    if (chars < 5) {
+        Console_SetError("Lines need room for at least 4 bytes!", "");
+        return 1;
+    }
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+
+    /* the filter's line isn't in the list so it goes first */
+    _Console_gl_begin(tty);
+    for (line = tty->filter_line ? tty->filter_line : tty->lines_head;
+            line != NULL;
+            line = line == tty->filter_line ? tty->lines_head : line->next) {
+        if (line->len >= chars) {
+            len = chars - 1;
+            while (len > 0 && (line->input[len] & 0xC0) == 0x80)
+                len--;
+            line->len = len;
+            if (line == tty->curr_line && tty->cursor > len)
+                tty->cursor = len;
+            memset(line->input + len, 0, chars - len);
+            /* a shorter filter matches other lines, a shorter line may not */
+            if (line == tty->filter_line)
+                tty->filter_gen++;
+            else
+                line->match_gen = 0;
+            /* rasterized again the next time it's drawn */
+            _Console_evict_texture(tty, line);
+        }
+
+        /* a failed shrink keeps the larger buffer, which is fine */
+        input = realloc(line->input, chars);
+        if (input) {
+            line->input = input;
+        } else if (chars > tty->max_input) {
+            _Console_gl_end(tty);
+            SDL_UnlockMutex(tty->mutex);
+            Console_SetError("Not enough memory to grow line text!", "");
+            return 1;
+        }
+        if (chars > tty->max_input)
+            memset(line->input + tty->max_input, 0, chars - tty->max_input);
+    }
+    _Console_gl_end(tty);
+
+    tty->max_input = chars;
+    tty->rebuild_line = true;
+    tty->rebuild_textures = _Console_m_uses_grid(tty);
+    tty->grid.rebuild = true;
+
+    SDL_UnlockMutex(tty->mutex);
+    return 0;
+}
+
+/*
+ * Show only the lines with `filter' in their input or output, with the
+ * matches highlighted. NULL shows every line again.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFilter (Console_tty *tty, const char *filter)
+{
+    assert(tty);
+    Console_Line *f;
+    int len;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+
+    if (!filter) {
+        _Console_end_filter(tty);
+        SDL_UnlockMutex(tty->mutex);
+        return 0;
+    }
+    if (_Console_begin_filter(tty)) {
+        SDL_UnlockMutex(tty->mutex);
+        return 1;
+    }
+
+    /* cut to fit at a character boundary like typed input */
+    f = tty->filter_line;
+    len = strlen(filter);
+    if (len >= tty->max_input) {
+        len = tty->max_input - 1;
+        while (len > 0 && (filter[len] & 0xC0) == 0x80)
+            len--;
+    }
+    memset(f->input, 0, tty->max_input);
+    memcpy(f->input, filter, len);
+    f->len = len;
+    tty->cursor = len;
+    tty->rebuild_line = true;
+    _Console_filter_changed(tty);
+
+    SDL_UnlockMutex(tty->mutex);
+    return 0;
+}
+
+/*
+ * Report the memory the console uses. GPU sizes are estimated from the sizes
+ * of the textures and buffers the console asked GL for.
+ */
+void
+Console_GetMemoryUsage (Console_tty *tty, Console_MemoryUsage *usage)
+{
+    assert(tty);
+    assert(usage);
+    Console_Line *line;
+    Console_Interned *in;
+    Console_Font *font;
+    Console_Glyph *g;
+    Console_Grid *grid = &tty->grid;
+    int i, j;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+
+    usage->cpu_text = 0;
+    usage->cpu_lines = 0;
+    /* the filter's line isn't in the list so it goes first */
+    for (line = tty->filter_line ? tty->filter_line : tty->lines_head;
+            line != NULL;
+            line = line == tty->filter_line ? tty->lines_head : line->next) {
+        usage->cpu_text += tty->max_input;
+        /* views of the caller's memory aren't counted */
+        if (line->output && line->release == _Console_free_text)
+            usage->cpu_text += line->output_len + 1;
+        usage->cpu_lines += sizeof(*line) +
+                            line->max_spans * sizeof(*line->spans);
+    }
+    /* interned outputs count once however many lines share them */
+    for (i = 0; i < CONSOLE_INTERN_BUCKETS; i++)
+        for (in = tty->interned[i]; in != NULL; in = in->next)
+            usage->cpu_text += sizeof(*in) + in->len;
+
+    usage->cpu_glyphs = 0;
+    for (font = tty->fonts; font != NULL; font = font->next) {
+        usage->cpu_glyphs += sizeof(*font);
+        for (i = 0; i < CONSOLE_GLYPH_PAGES; i++) {
+            if (!font->pages[i])
+                continue;
+            usage->cpu_glyphs += sizeof(*font->pages[i]);
+            for (j = 0; j < CONSOLE_GLYPH_PAGE_SIZE; j++) {
+                g = &font->pages[i]->glyphs[j];
+                if (g->bitmap && !g->mapped)
+                    usage->cpu_glyphs += (size_t)g->width * g->rows;
+            }
+        }
+    }
+
+    usage->cpu_render =
+        tty->batch.max_vertices * sizeof(*tty->batch.vertices) +
+        tty->batch.max_draws * sizeof(*tty->batch.draws) +
+        grid->max_slots * sizeof(*grid->slots);
+    if (grid->cells)
+        usage->cpu_render += (size_t)grid->cols * grid->rows *
+                             CONSOLE_CELL_BYTES;
+    if (tty->frame)
+        usage->cpu_render += (size_t)tty->frame_width * tty->frame_height * 4;
+    _Console_gpu_usage(tty, &usage->gpu_textures, &usage->gpu_buffers);
+
+    SDL_UnlockMutex(tty->mutex);
+}
+
+/*
+ * Convert counters kept in performance counter ticks for the stats.
+ */
+void
+_Console_export_counters (Console_Counters *out, Console_StatCounters *c)
+{
+    double ms = 1000.0 / SDL_GetPerformanceFrequency();
+
+    out->draw_calls = c->draw_calls;
+    out->texture_uploads = c->texture_uploads;
+    out->texture_upload_bytes = c->texture_bytes;
+    out->glyphs_rasterized = c->glyphs;
+    out->lines_rebuilt = c->lines_rebuilt;
+    out->render_ms = c->render_time * ms;
+    out->layout_ms = c->layout_time * ms;
+    out->input_ms = c->input_time * ms;
+    out->mutex_wait_ms = c->lock_time * ms;
+}
+
+void
+Console_GetStats (Console_tty *tty, Console_Stats *stats)
+{
+    assert(tty);
+    assert(stats);
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+
+    _Console_export_counters(&stats->frame, &tty->stats_frame);
+    _Console_export_counters(&stats->total, &tty->stats_total);
+    stats->frames = tty->stats_frames;
+    stats->lines = tty->num_lines;
+    stats->pooled_textures = tty->pool_len;
+
+    SDL_UnlockMutex(tty->mutex);
+}
+
+/*
+ * Start recording trace events, keeping the last `max_events' of them.
+ * Tracing again starts over.
+ */
+int
+Console_StartTrace (Console_tty *tty, int max_events)
+{
+    assert(tty);
+    Console_Trace *t;
+    int ret = 0;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+
+    _Console_trace_free(tty);
+    t = calloc(1, sizeof(*t));
+    if (t) {
+        t->capacity = max_events > 0 ? max_events : CONSOLE_TRACE_EVENTS;
+        t->events = calloc(t->capacity, sizeof(*t->events));
+    }
+    if (!t || !t->events) {
+        free(t);
+        Console_SetError("Not enough memory to trace!", "");
+        ret = 1;
+        goto unlock;
+    }
+    tty->trace = t;
+
+unlock:
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
+
+void
+Console_StopTrace (Console_tty *tty)
+{
+    assert(tty);
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    _Console_trace_free(tty);
+    SDL_UnlockMutex(tty->mutex);
+}
+
+/*
+ * Write the recorded events to `path' as Chrome trace JSON. GPU work is on a
+ * track of its own.
+ */
+int
+Console_WriteTrace (Console_tty *tty, const char *path)
+{
+    assert(tty);
+    Console_Trace *t;
+    Console_TraceEvent *e;
+    unsigned i, first, next;
+    double us = 1e6 / SDL_GetPerformanceFrequency();
+    FILE *f;
+    int ret = 0;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+
+    t = tty->trace;
+    if (!t) {
+        Console_SetError("The console isn't being traced!", "");
+        ret = 1;
+        goto unlock;
+    }
+    f = fopen(path, "w");
+    if (!f) {
+        Console_SetError("Failed to open trace file: ", path);
+        ret = 1;
+        goto unlock;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+            "\"args\":{\"name\":\"GPU\"}}");
+    next = (unsigned)SDL_AtomicGet(&t->next);
+    first = next > t->capacity ? next - t->capacity : 0;
+    for (i = first; i != next; i++) {
+        e = &t->events[i % t->capacity];
+        /* skip events still being written */
+        if ((unsigned)SDL_AtomicGet(&e->seq) != i + 1)
+            continue;
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lu}",
+                e->name, e->gpu ? "gpu" : "console", e->start * us,
+                (e->end - e->start) * us,
+                e->gpu ? 0UL : (unsigned long)e->thread);
+    }
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) {
+        Console_SetError("Failed to write trace file: ", path);
+        ret = 1;
+    }
+
+unlock:
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
+
+/*
+ * Give the time the last frame took, instead of the console timing frames
+ * from one Console_Draw to the next.
+ */
+void
+Console_RecordFrameTime (Console_tty *tty, float ms)
+{
+    assert(tty);
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    tty->frame_times_given = true;
+    _Console_record_frame_time(tty, ms);
+    SDL_UnlockMutex(tty->mutex);
+}
+
+void
+Console_SetFrameGraph (Console_tty *tty, int show)
+{
+    assert(tty);
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    tty->frame_graph = show ? true : false;
+    SDL_UnlockMutex(tty->mutex);
+}
+
+void
+Console_SetBuiltinCommands (Console_tty *tty, int enable)
+{
+    assert(tty);
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    tty->builtins = enable ? true : false;
+    SDL_UnlockMutex(tty->mutex);
+}
+
+/*
+ * Record the events the console handles, what the input function and
+ * generators give, and when frames are drawn to `path'.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_StartRecording (Console_tty *tty, const char *path)
+{
+    assert(tty);
+    int ret = 0;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+
+    if (tty->record || tty->replaying) {
+        Console_SetError("The console is already recording or replaying!",
+                "");
+        ret = 1;
+        goto unlock;
+    }
+    tty->record = fopen(path, "wb");
+    if (!tty->record) {
+        Console_SetError("Failed to open recording: ", path);
+        ret = 1;
+        goto unlock;
+    }
+    fwrite(CONSOLE_REC_MAGIC, 1, CONSOLE_REC_MAGIC_LEN, tty->record);
+    _Console_put_varint(tty->record, tty->window_width);
+    _Console_put_varint(tty->record, tty->window_height);
+    tty->record_last = SDL_GetPerformanceCounter();
+
+unlock:
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
+
+int
+Console_StopRecording (Console_tty *tty)
+{
+    assert(tty);
+    int ret = 0;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+    if (tty->record) {
+        if (ferror(tty->record) | fclose(tty->record)) {
+            Console_SetError("Failed to write recording!", "");
+            ret = 1;
+        }
+        tty->record = NULL;
+    }
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
+
+/*
+ * Load the recording at `path'.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+_Console_load_replay (Console_Playback *r, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    long len;
+
+    if (!f) {
+        Console_SetError("Failed to open recording: ", path);
+        return 1;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+            fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        Console_SetError("Failed to read recording: ", path);
+        return 1;
+    }
+    r->data = malloc(len > 0 ? len : 1);
+    if (!r->data) {
+        fclose(f);
+        Console_SetError("Not enough memory to replay!", "");
+        return 1;
+    }
+    r->len = fread(r->data, 1, len, f);
+    r->pos = 0;
+    r->time = 0;
+    fclose(f);
+
+    if (r->len != (size_t)len || r->len < CONSOLE_REC_MAGIC_LEN ||
+            memcmp(r->data, CONSOLE_REC_MAGIC, CONSOLE_REC_MAGIC_LEN) != 0) {
+        free(r->data);
+        Console_SetError("Not a console recording: ", path);
+        return 1;
+    }
+    r->pos = CONSOLE_REC_MAGIC_LEN;
+    return 0;
+}
+
+/*
+ * Play back a recording, giving the console its events and drawing where
+ * frames were drawn.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_Replay (Console_tty *tty, const char *path, int realtime,
+        Console_FrameFunction frame, void *frame_data)
+{
+    assert(tty);
+    Console_Playback r;
+    Console_InputFunction input_func;
+    void *input_func_data;
+    SDL_Event e;
+    Uint64 v[2], start, now;
+    Sint64 wait;
+    int type, len, ret = 0;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+    if (tty->record || tty->replaying) {
+        Console_SetError("The console is already recording or replaying!",
+                "");
+        SDL_UnlockMutex(tty->mutex);
+        return 1;
+    }
+    if (_Console_load_replay(&r, path)) {
+        SDL_UnlockMutex(tty->mutex);
+        return 1;
+    }
+    /* the recording's outputs stand in for the input function */
+    input_func = tty->input_func;
+    input_func_data = tty->input_func_data;
+    tty->input_func = _Console_replay_input;
+    tty->input_func_data = &r;
+    tty->replaying = true;
+    SDL_UnlockMutex(tty->mutex);
+
+    /* headless consoles start at the recorded size */
+    if (_Console_replay_varint(&r, &v[0]) ||
+            _Console_replay_varint(&r, &v[1])) {
+        Console_SetError("Recording is cut short: ", path);
+        ret = 1;
+        goto done;
+    }
+    if (tty->headless && Console_SetFrameSize(tty, v[0], v[1])) {
+        ret = 1;
+        goto done;
+    }
+
+    start = SDL_GetPerformanceCounter();
+    while (!_Console_replay_record(&r, &type)) {
+        if (realtime) {
+            now = SDL_GetPerformanceCounter();
+            wait = (Sint64)r.time - (Sint64)((now - start) * 1000000 /
+                    SDL_GetPerformanceFrequency());
+            if (wait > 1000)
+                SDL_Delay(wait / 1000);
+        }
+
+        memset(&e, 0, sizeof(e));
+        switch (type) {
+        case CONSOLE_REC_KEY:
+            if (_Console_replay_varint(&r, &v[0]) ||
+                    _Console_replay_varint(&r, &v[1]))
+                goto corrupt;
+            e.type = SDL_KEYDOWN;
+            e.key.keysym.sym = (SDL_Keycode)v[0];
+            e.key.keysym.mod = (Uint16)v[1];
+            _Console_replay_event(tty, &e);
+            break;
+
+        case CONSOLE_REC_TEXT:
+            if (r.pos == r.len)
+                goto corrupt;
+            len = r.data[r.pos++];
+            if (len >= (int)sizeof(e.text.text) || (size_t)len > r.len - r.pos)
+                goto corrupt;
+            e.type = SDL_TEXTINPUT;
+            memcpy(e.text.text, r.data + r.pos, len);
+            r.pos += len;
+            _Console_replay_event(tty, &e);
+            break;
+
+        case CONSOLE_REC_RESIZE:
+            if (_Console_replay_varint(&r, &v[0]) ||
+                    _Console_replay_varint(&r, &v[1]))
+                goto corrupt;
+            if (tty->headless) {
+                if (Console_SetFrameSize(tty, v[0], v[1])) {
+                    ret = 1;
+                    goto done;
+                }
+                break;
+            }
+            SDL_SetWindowSize(tty->window, v[0], v[1]);
+            e.type = SDL_WINDOWEVENT;
+            e.window.event = SDL_WINDOWEVENT_RESIZED;
+            e.window.data1 = v[0];
+            e.window.data2 = v[1];
+            _Console_replay_event(tty, &e);
+            break;
+
+        case CONSOLE_REC_FRAME:
+            if (Console_Draw(tty)) {
+                ret = 1;
+                goto done;
+            }
+            if (frame)
+                frame(frame_data);
+            break;
+
+        default:
+            /* outputs are only read by the input function and generators */
+            goto corrupt;
+        }
+    }
+    goto done;
+
+corrupt:
+    Console_SetError("Replay doesn't match the recording: ", path);
+    ret = 1;
+done:
+    if (_Console_lock(tty) == 0) {
+        /* generators still reading the recording go with it */
+        if (tty->generator == _Console_replay_line)
+            _Console_stop_generator(tty);
+        tty->input_func = input_func;
+        tty->input_func_data = input_func_data;
+        tty->replaying = false;
+        SDL_UnlockMutex(tty->mutex);
+    }
+    free(r.data);
+    return ret;
+}
+
+/*
+ * Collapse a command that prints what it printed on the line before into
+ * that line, counting it up.
+ */
+void
+Console_SetCollapseRepeats (Console_tty *tty, int collapse)
+{
+    assert(tty);
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    tty->collapse_repeats = collapse ? true : false;
+    SDL_UnlockMutex(tty->mutex);
+}
+
+/*
+ * Keep one copy of every distinct output, shared by the lines that printed it.
+ * Outputs stored before turning this on keep their own copies.
+ */
+void
+Console_SetInternOutput (Console_tty *tty, int intern)
+{
+    assert(tty);
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    tty->intern_output = intern ? true : false;
+    SDL_UnlockMutex(tty->mutex);
+}
+
+/*
+ * Have the console save the GL state it changes while drawing and restore it
+ * afterwards. Only the state the console actually touches is queried, once.
+ * By default this is off and the console resets what it changed to GL's
+ * defaults, which avoids the cost of querying GL.
+ */
+void
+Console_SetRestoreGLState (Console_tty *tty, int restore)
+{
+    assert(tty);
+    tty->gl_state.restore = restore ? true : false;
+    tty->gl_state.known = 0;
+}
+
+/*
+ * Forget what the console knows of GL's state, so it's queried or set again
+ * the next time the console draws.
+ */
+void
+Console_InvalidateGLState (Console_tty *tty)
+{
+    assert(tty);
+    tty->gl_state.known = 0;
+}
+
+/*
+ * Snapshots keep the scrollback in a file that's mapped to restore it: the
+ * header, an index of `num_lines' lines from the oldest up, then the text of
+ * every line, its input followed by its output. Native byte order.
+ */
+#define CONSOLE_SNAPSHOT_MAGIC   "SDLCSNP"
+#define CONSOLE_SNAPSHOT_VERSION 1
+/* snapshots are written through a buffer this big on the stack */
+#define CONSOLE_SNAPSHOT_CHUNK   4096
+
+typedef struct _Console_SnapshotHeader {
+    char magic[8];
+    Uint32 version;
+    Uint32 num_lines;
+    Uint64 text_size;
+} Console_SnapshotHeader;
+
+typedef struct _Console_SnapshotLine {
+    Uint64 offset;     /* of the input from the start of the text */
+    Uint32 input_len;
+    Uint32 output_len;
+    Sint32 repeat;
+    Uint32 output_only;
+} Console_SnapshotLine;
+
+/* Writes a snapshot without allocating, so it works in a crash handler */
+typedef struct _Console_SnapshotWriter {
+    int fd;
+    size_t len;
+    bool failed;
+    char buf[CONSOLE_SNAPSHOT_CHUNK];
+} Console_SnapshotWriter;
+
+/* A mapped snapshot, unmapped once no line's output is in it */
+typedef struct _Console_SnapshotMap {
+    unsigned char *data;
+    size_t size;
+    int refs;
+} Console_SnapshotMap;
+
+void
+_Console_snapshot_flush (Console_SnapshotWriter *w)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (!w->failed && done < w->len) {
+        n = write(w->fd, w->buf + done, w->len - done);
+        if (n > 0)
+            done += n;
+        else if (n == 0 || errno != EINTR)
+            w->failed = true;
+    }
+    w->len = 0;
+}
+
+void
+_Console_snapshot_put (Console_SnapshotWriter *w, const void *data,
+        size_t len)
+{
+    const char *p = data;
+    size_t n;
+
+    while (len > 0 && !w->failed) {
+        if (w->len == sizeof(w->buf))
+            _Console_snapshot_flush(w);
+        n = sizeof(w->buf) - w->len;
+        if (n > len)
+            n = len;
+        memcpy(w->buf + w->len, p, n);
+        w->len += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void
+_Console_release_snapshot (const char *text, void *data)
+{
+    Console_SnapshotMap *m = data;
+
+    if (--m->refs == 0) {
+        munmap(m->data, m->size);
+        free(m);
+    }
+}
+
+/*
+ * Writes the snapshot without touching the console's lock, which the caller
+ * holds or, in a crash handler, can't wait for.
+ */
+int
+_Console_save_snapshot (Console_tty *tty, const char *path)
+{
+    Console_SnapshotWriter w;
+    Console_SnapshotHeader h;
+    Console_SnapshotLine sl;
+    Console_Line *l;
+    Uint64 offset = 0;
+
+    w.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    w.len = 0;
+    w.failed = w.fd < 0;
+
+    /* the line being typed isn't kept */
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CONSOLE_SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = CONSOLE_SNAPSHOT_VERSION;
+    for (l = tty->lines_tail; l && l != tty->lines_head; l = l->prev) {
+        h.num_lines++;
+        h.text_size += l->len + l->output_len;
+    }
+    _Console_snapshot_put(&w, &h, sizeof(h));
+
+    for (l = tty->lines_tail; l && l != tty->lines_head; l = l->prev) {
+        sl.offset = offset;
+        sl.input_len = l->len;
+        sl.output_len = l->output_len;
+        sl.repeat = l->repeat;
+        sl.output_only = l->output_only;
+        _Console_snapshot_put(&w, &sl, sizeof(sl));
+        offset += l->len + l->output_len;
+    }
+    for (l = tty->lines_tail; l && l != tty->lines_head; l = l->prev) {
+        _Console_snapshot_put(&w, l->input, l->len);
+        if (l->output_len > 0)
+            _Console_snapshot_put(&w, l->output, l->output_len);
+    }
+    _Console_snapshot_flush(&w);
+
+    if (w.fd >= 0 && close(w.fd) != 0)
+        w.failed = true;
+    if (w.failed) {
+        Console_SetError("Failed to write snapshot: ", path);
+        return 1;
+    }
+    return 0;
+}
+
+int
+Console_SaveSnapshot (Console_tty *tty, const char *path)
+{
+    assert(tty);
+    assert(path);
+    int ret;
+
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
+    }
+    ret = _Console_save_snapshot(tty, path);
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
+
+int
+Console_SaveSnapshotUnlocked (Console_tty *tty, const char *path)
+{
+    assert(tty);
+    assert(path);
+
+    return _Console_save_snapshot(tty, path);
 }
 
 int
-Console_InputWatch (void *data, SDL_Event *e)
+Console_LoadSnapshot (Console_tty *tty, const char *path)
 {
-    assert(data);
-    Console_tty *tty = data;
+    assert(tty);
+    assert(path);
+    const Console_SnapshotHeader *h;
+    const Console_SnapshotLine *index, *sl;
+    const char *text;
+    Console_SnapshotMap *m = NULL;
+    Console_Line *line;
+    unsigned char *map;
+    struct stat st;
+    Uint32 i;
+    int fd, len, ret = 0;
 
-    if (SDL_LockMutex(tty->mutex) != 0) {
+    if (_Console_lock(tty) != 0) {
         Console_SetError("Mutex failed to lock!", SDL_GetError());
-        return 0;
+        return 1;
     }
 
-    if (!tty->status)
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        Console_SetError("Failed to open snapshot: ", path);
+        ret = 1;
         goto unlock;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*h)) {
+        close(fd);
+        Console_SetError("Not a console snapshot: ", path);
+        ret = 1;
+        goto unlock;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        Console_SetError("Failed to map snapshot: ", path);
+        ret = 1;
+        goto unlock;
+    }
 
-    switch (e->type) {
-    case SDL_KEYDOWN:
-        switch (e->key.keysym.sym) {
-        case SDLK_BACKSPACE:
-            _Console_remove_input(tty);
-            break;
-
-        case SDLK_RETURN:
-            Console_NewLine(tty, tty->input_func, tty->input_func_data);
-            break;
-
-        /* copy */
-        case SDLK_c:
-            if (SDL_GetModState() & KMOD_CTRL) {
-                /* SDL_SetClipboardText(tty->curr_line->input) */
-            }
-            break;
-
-        /* paste */
-        case SDLK_v:
-            if (SDL_GetModState() & KMOD_CTRL) {
-                /* Console_GetInput(tty, SDL_GetClipboardText()); */
-            }
-            break;
-
-        case SDLK_UP:
-            Console_SetCurrLine(tty, LINE_UP);
-            break;
+    /* everything is checked before any line is made */
+    h = (const Console_SnapshotHeader*)map;
+    index = (const Console_SnapshotLine*)(h + 1);
+    if (memcmp(h->magic, CONSOLE_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CONSOLE_SNAPSHOT_VERSION ||
+        h->num_lines >
+            (st.st_size - sizeof(*h)) / sizeof(Console_SnapshotLine) ||
+        h->text_size > st.st_size - sizeof(*h) -
+            (size_t)h->num_lines * sizeof(Console_SnapshotLine))
+        goto error;
+    text = (const char*)(index + h->num_lines);
+    for (i = 0, sl = index; i < h->num_lines; i++, sl++) {
+        if (sl->offset > h->text_size ||
+            sl->input_len > h->text_size - sl->offset ||
+            sl->output_len > h->text_size - sl->offset - sl->input_len)
+            goto error;
+    }
 
-        case SDLK_DOWN:
-            Console_SetCurrLine(tty, LINE_DOWN);
-            break;
+    m = malloc(sizeof(*m));
+    if (!m) {
+        munmap(map, st.st_size);
+        Console_SetError("Not enough memory to load snapshot!", "");
+        ret = 1;
+        goto unlock;
+    }
+    m->data = map;
+    m->size = st.st_size;
+    m->refs = 1;
 
-        case SDLK_LEFT:
-            if (tty->cursor > 0) {
-                tty->cursor--;
-                tty->rebuild_line = true;
-            }
+    /*
+     * The newest lines go below the oldest ones there are until the
+     * scrollback is full. Outputs stay in the mapping and lines are only
+     * laid out and rasterized as they come on screen.
+     */
+    for (i = h->num_lines; i-- > 0 && tty->num_lines < tty->max_lines;) {
+        sl = &index[i];
+        line = _Console_alloc_line(tty);
+        if (!line) {
+            ret = 1;
             break;
+        }
 
-        case SDLK_RIGHT:
-            if (tty->cursor < tty->max_input && 
-                    tty->cursor < tty->curr_line->len) {
-                tty->cursor++;
-                tty->rebuild_line = true;
-            }
-            break;
+        /* inputs longer than lines take are cut at a character boundary */
+        len = sl->input_len < (Uint32)tty->max_input ?
+            (int)sl->input_len : tty->max_input - 1;
+        if (len < (int)sl->input_len)
+            while (len > 0 && (text[sl->offset + len] & 0xc0) == 0x80)
+                len--;
+        memcpy(line->input, text + sl->offset, len);
+        line->len = len;
+        if (sl->output_len > 0) {
+            line->output = text + sl->offset + sl->input_len;
+            line->output_len = sl->output_len;
+            line->release = _Console_release_snapshot;
+            line->release_data = m;
+            m->refs++;
         }
-        break;
+        line->repeat = sl->repeat > 0 ? sl->repeat : 1;
+        line->output_only = sl->output_only != 0;
+        line->match_gen = 0;
 
-    case SDL_TEXTINPUT:
-        _Console_get_input(tty, e->text.text);
-        break;
+        line->prev = tty->lines_tail;
+        tty->lines_tail->next = line;
+        tty->lines_tail = line;
     }
+    _Console_release_snapshot(NULL, m);
+
+    tty->grid.rebuild = true;
+    if (_Console_m_uses_grid(tty))
+        tty->rebuild_textures = true;
+    goto unlock;
 
+error:
+    munmap(map, st.st_size);
+    Console_SetError("Snapshot is damaged: ", path);
+    ret = 1;
 unlock:
     SDL_UnlockMutex(tty->mutex);
-    return 0;
+    return ret;
 }
 
-/*
- * Watch for the trigger to toggle having the console displayed and handling
- * input or off and not handling input.
- */
 int
-Console_TriggerWatch (void *data, SDL_Event *e)
+Console_ExecFile (Console_tty *tty, const char *path)
 {
-    assert(data);
-    Console_tty *tty = data;
+    assert(tty);
+    assert(path);
+    FILE *f, *record;
+    int ret = 0;
 
-    if (SDL_LockMutex(tty->mutex) != 0) {
+    if (_Console_lock(tty) != 0) {
         Console_SetError("Mutex failed to lock!", SDL_GetError());
-        return 0;
+        return 1;
     }
-
-    /* watch for window size changes to update our console behind-the-scenes */
-    if (e->type == SDL_WINDOWEVENT && 
-        e->window.event == SDL_WINDOWEVENT_RESIZED) {
-        _Console_set_window_size(tty);
+    if (tty->in_generator) {
+        Console_SetError("Generators can't run command files!", "");
+        ret = 1;
+        goto unlock;
+    }
+    f = fopen(path, "r");
+    if (!f) {
+        Console_SetError("Failed to open command file: ", path);
+        ret = 1;
+        goto unlock;
     }
 
-    if (e->type == SDL_KEYDOWN && e->key.keysym.sym == tty->trigger_key) {
-        if (tty->status) {
-            SDL_DelEventWatch(Console_InputWatch, tty);
-            SDL_StopTextInput();
-            tty->status = false;
+    /*
+     * From a command, or between the commands of a file, the file waits for
+     * the command to finish like one given to `exec'.
+     */
+    if (tty->in_command || tty->exec_depth > 0) {
+        if (tty->exec_file) {
+            fclose(f);
+            Console_SetError("A command file is already waiting to run!",
+                    "");
+            ret = 1;
         } else {
-            SDL_StartTextInput();
-            SDL_AddEventWatch(Console_InputWatch, tty);
-            tty->status = true;
+            tty->exec_file = f;
         }
+        goto unlock;
     }
 
+    /* commands run from code aren't part of a recorded session */
+    record = tty->record;
+    tty->record = NULL;
+    ret = _Console_exec(tty, f);
+    tty->record = record;
+
+unlock:
     SDL_UnlockMutex(tty->mutex);
-    return 0; /* return is ignored */
+    return ret;
 }
 
-/*
- * Create the console. 
- * The console will load the font at `font_path'. The font path *must* be a
- * monospaced or fixed-width. 
- * The `trigger_key' is the keyboard key that toggles the console on and off.
- * `input_func' is the function that uses the input to the console and 
- * `input_func_data' is userdata given to that function.
- * Returns NULL on error.
- */
-Console_tty* 
-Console_Create (SDL_Window *window, 
-                const char *font_path, 
-                const int font_size,
-                SDL_Keycode trigger_key,
-                Console_InputFunction input_func,
-                void *input_func_data)
+int
+Console_StartLog (Console_tty *tty, const char *path, size_t max_size,
+        int keep)
 {
-    Console_tty *tty = malloc(sizeof(*tty));
+    assert(tty);
+    assert(path);
+    Console_Log *log;
+    long pos;
+    int ret = 0;
 
-    if (!tty) {
-        Console_SetError("Not enough memory to create console!", "");
-        goto exit;
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return 1;
     }
-
-    tty->window       = NULL;
-    tty->lines_head   = NULL;
-    tty->lines_tail   = NULL;
-    tty->curr_line    = NULL;
-    tty->rebuild_line = true;
-    tty->cursor       = 0;
-    tty->status       = false;
-    tty->prompt       = DEFAULT_PROMPT;
-    tty->prompt_len   = DEFAULT_PROMPT_LEN;
-    tty->max_lines    = DEFAULT_LINE_LENGTH;
-    tty->max_input    = DEFAULT_LINE_CHARS;
-    tty->trigger_key  = trigger_key;
-    tty->input_func   = input_func;
-    tty->input_func_data = input_func_data;
-    tty->bg_color     = (Console_Color) { 0.0f, 0.0f, 0.0f, 0.9f };
-    tty->font_color   = (Console_Color) { 1.0f, 1.0f, 1.0f, 1.0f };
-
-    tty->mutex = SDL_CreateMutex();
-    if (!tty->mutex) {
-        Console_SetError("Failed to create mutex: ", SDL_GetError());
-        free(tty);
-        tty = NULL;
-        goto exit;
+    if (tty->log) {
+        Console_SetError("The console is already logging!", "");
+        ret = 1;
+        goto unlock;
     }
 
-    /*
-     * TODO: Nearly Done. This is the final stretch:
-     *   - handle background color
-     *   - handle text color
-     */
-
-    if (_Console_init_ft(tty, font_path, font_size)) {
-        free(tty);
-        tty = NULL;
-        goto exit;
+    log = calloc(1, sizeof(*log));
+    if (!log) {
+        Console_SetError("Not enough memory to log!", "");
+        ret = 1;
+        goto unlock;
     }
-
-    if (_Console_init_gl(tty, window)) {
-        _Console_destroy_ft(tty);
-        free(tty);
-        tty = NULL;
-        goto exit;
+    /* with no files to keep, rotating would only throw the log away */
+    log->max_size = keep > 0 ? max_size : 0;
+    log->keep = keep > 0 ? keep : 0;
+    log->path = strdup(path);
+    log->from = malloc(strlen(path) + 16);
+    log->to = malloc(strlen(path) + 16);
+    log->mutex = SDL_CreateMutex();
+    log->cond = SDL_CreateCond();
+    if (!log->path || !log->from || !log->to || !log->mutex || !log->cond) {
+        Console_SetError("Not enough memory to log!", "");
+        goto error;
     }
 
-    if (_Console_create_line(tty)) {
-        _Console_destroy_ft(tty);
-        _Console_destroy_gl(tty);
-        free(tty);
-        tty = NULL;
-        goto exit;
+    /* a log from an earlier run is added to */
+    log->file = fopen(path, "a");
+    if (!log->file) {
+        Console_SetError("Failed to open log: ", path);
+        goto error;
     }
+    fseek(log->file, 0, SEEK_END);
+    pos = ftell(log->file);
+    log->size = pos > 0 ? pos : 0;
+
+    log->thread = SDL_CreateThread(_Console_log_thread, "Console log", log);
+    if (!log->thread) {
+        Console_SetError("Failed to start log thread: ", SDL_GetError());
+        goto error;
+    }
+    tty->log = log;
+    goto unlock;
 
-    /* handle info that needs both freetype & opengl */
-    _Console_create_trans_texture(tty, &tty->cursor_texture, 255 * 0.75f);
-    _Console_create_trans_texture(tty, &tty->bg_texture, 255*tty->bg_color.a);
-    _Console_set_window_size(tty);
+error:
+    _Console_log_free(log);
+    ret = 1;
+unlock:
+    SDL_UnlockMutex(tty->mutex);
+    return ret;
+}
 
-    SDL_AddEventWatch(Console_TriggerWatch, tty);
+void
+Console_StopLog (Console_tty *tty)
+{
+    assert(tty);
+    Console_Log *log;
 
-exit:
-    return tty;
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    log = tty->log;
+    tty->log = NULL;
+    SDL_UnlockMutex(tty->mutex);
+
+    if (!log)
+        return;
+    /* the writer writes out what's left before it stops */
+    SDL_LockMutex(log->mutex);
+    log->stop = true;
+    SDL_CondSignal(log->cond);
+    SDL_UnlockMutex(log->mutex);
+    SDL_WaitThread(log->thread, NULL);
+    _Console_log_free(log);
 }
 
-/*
- * Handle drawing the console if it is toggled.
- * Returns 1 on an error, 0 otherwise.
- */
 int
-Console_Draw (Console_tty *tty)
+Console_Listen (Console_tty *tty, const char *path, int threaded)
 {
+    assert(tty);
+    assert(path);
+    struct sockaddr_un addr;
+    struct stat st;
+    Console_Remote *r;
     int ret = 0;
 
-    if (SDL_LockMutex(tty->mutex) != 0) {
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        Console_SetError("Socket path is too long: ", path);
+        return 1;
+    }
+    if (_Console_lock(tty) != 0) {
         Console_SetError("Mutex failed to lock!", SDL_GetError());
-        ret = 1;
-        goto exit;
+        return 1;
     }
-
-    if (!tty->status)
+    if (tty->remote) {
+        Console_SetError("The console is already listening!", "");
+        ret = 1;
         goto unlock;
+    }
 
-    /* if something's been written to the error string */
-    if ( _Console_errstr[0] != '\0') {
+    r = calloc(1, sizeof(*r));
+    if (!r || !(r->path = strdup(path))) {
+        free(r);
+        Console_SetError("Not enough memory to listen!", "");
         ret = 1;
         goto unlock;
     }
+    r->tty = tty;
+    r->fd = -1;
+    r->wake[0] = -1;
+    r->wake[1] = -1;
+
+    /* a socket left behind by a program that didn't stop listening */
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    r->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (r->fd == -1 || fcntl(r->fd, F_SETFL, O_NONBLOCK) == -1 ||
+            bind(r->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        Console_SetError("Failed to listen on socket: ", strerror(errno));
+        goto error;
+    }
+    r->bound = true;
+    if (listen(r->fd, SOMAXCONN) == -1) {
+        Console_SetError("Failed to listen on socket: ", strerror(errno));
+        goto error;
+    }
 
-    if (Console_Render(tty))
-        ret = 1;
+    if (threaded) {
+        if (pipe(r->wake) == -1 ||
+                fcntl(r->wake[0], F_SETFL, O_NONBLOCK) == -1 ||
+                fcntl(r->wake[1], F_SETFL, O_NONBLOCK) == -1) {
+            Console_SetError("Failed to make remote pipe: ", strerror(errno));
+            goto error;
+        }
+        r->thread = SDL_CreateThread(_Console_remote_thread,
+                "Console remote", r);
+        if (!r->thread) {
+            Console_SetError("Failed to start remote thread: ",
+                    SDL_GetError());
+            goto error;
+        }
+    }
+    tty->remote = r;
+    goto unlock;
 
+error:
+    _Console_remote_free(r);
+    ret = 1;
 unlock:
     SDL_UnlockMutex(tty->mutex);
-exit:
     return ret;
 }
 
-/*
- * In the `input_func`, this function handles memory for output and should
- * be used instead of malloc, realloc, etc.
- */
 void
-Console_SetOutput (char **out, const char *s)
+Console_StopListening (Console_tty *tty)
 {
-    *out = strdup(s);
-}
+    assert(tty);
+    Console_Remote *r;
 
-/*
- * Set the background color of the console.
- * Default is 0.0f, 0.0f, 0.0f, 0.90f.
- */
-void
-Console_SetBackgroundColor (Console_tty *tty, Console_Color c)
-{
-    tty->bg_color = c;
-    _Console_create_trans_texture(tty, &tty->bg_texture, 255*tty->bg_color.a);
-}
+    if (_Console_lock(tty) != 0) {
+        Console_SetError("Mutex failed to lock!", SDL_GetError());
+        return;
+    }
+    r = tty->remote;
+    tty->remote = NULL;
+    SDL_UnlockMutex(tty->mutex);
 
-/*
- * Handle drawing the console if it is toggled.
- * Returns 1 on an error, 0 otherwise.
- */
-void
-Console_SetFontColor (Console_tty *tty, Console_Color c)
-{
-    tty->font_color = c;
+    if (!r)
+        return;
+    /* the thread may be waiting for the lock, so it's joined without it */
+    if (r->thread) {
+        SDL_AtomicSet(&r->stop, 1);
+        _Console_remote_wake(r);
+        SDL_WaitThread(r->thread, NULL);
+    }
+    _Console_remote_free(r);
 }
 
 void
@@ -1125,25 +7690,39 @@ Console_Destroy (Console_tty* tty)
     assert(tty);
     Console_Line *line; 
 
+    /* the remote thread takes the lock so it's stopped first */
+    Console_StopListening(tty);
+    Console_StopLog(tty);
+
     /* 
      * Make sure to lock the mutex and stop the threads before destroying the
      * mutex and freeing any data the threads may be using.
      */
-    if (SDL_LockMutex(tty->mutex) != 0)
+    if (_Console_lock(tty) != 0) {
         Console_SetError("Mutex failed to lock!", SDL_GetError());
+    }
     SDL_DelEventWatch(Console_TriggerWatch, tty);
     if (tty->status)
         SDL_DelEventWatch(Console_InputWatch, tty);
     SDL_UnlockMutex(tty->mutex);
     SDL_DestroyMutex(tty->mutex);
 
+    _Console_stop_generator(tty);
+    _Console_end_filter(tty);
+    _Console_trace_free(tty);
+    if (tty->record)
+        fclose(tty->record);
+    free(tty->frame);
+
+    /* the atlas refers to the glyphs so it goes first */
+    if (tty->gl_ready)
+        _Console_destroy_gl(tty);
     _Console_destroy_ft(tty);
-    _Console_destroy_gl(tty);
 
     for (line = tty->lines_head; line != NULL; line = line->next) {
         free(line->input);
-        if (line->output)
-            free(line->output);
+        _Console_free_output(tty, line);
+        free(line->spans);
         if (line->prev != NULL)
             free(line->prev);
         if (line->next == NULL) {
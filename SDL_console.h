@@ -1,14 +1,79 @@
 #ifndef SDL_CONSOLE
 #define SDL_CONSOLE
 
+#include <stddef.h>
+
 struct _SDL_console_tty;
 typedef struct _SDL_console_tty Console_tty;
 typedef int (*Console_InputFunction)(const char *, void*, char **);
+typedef void (*Console_ReleaseFunction)(const char *, void*);
+typedef int (*Console_GeneratorFunction)(void *, char **);
+typedef void (*Console_FinishFunction)(void *);
+typedef void (*Console_FrameFunction)(void *);
 
 typedef struct _console_color {
     float r, g, b, a;
 } Console_Color;
 
+typedef enum _console_render_mode {
+    /* every line is rasterized into a texture of its own (default) */
+    CONSOLE_RENDER_LINES,
+    /* 
+     * the screen is a grid of cells in a buffer texture and glyphs come from
+     * an atlas. Needs OpenGL 3.1.
+     */
+    CONSOLE_RENDER_GRID,
+    /*
+     * like CONSOLE_RENDER_GRID but glyphs are signed distance fields rendered
+     * once at a reference size and scaled on the GPU, so changing the font
+     * size costs no rasterizing. Needs FreeType 2.11.
+     */
+    CONSOLE_RENDER_SDF
+} Console_RenderMode;
+
+/* Bytes used by the console, see Console_GetMemoryUsage */
+typedef struct _console_memory_usage {
+    size_t cpu_text;      /* input buffers and output text */
+    size_t cpu_lines;     /* line records and their color runs */
+    size_t cpu_glyphs;    /* glyph tables and bitmaps of the loaded fonts */
+    size_t cpu_render;    /* vertex arrays, grid cells, the headless frame */
+    size_t gpu_textures;  /* line textures and the glyph atlas */
+    size_t gpu_buffers;   /* vertex buffer and the grid's cells */
+} Console_MemoryUsage;
+
+/* Work done by the console, see Console_GetStats */
+typedef struct _console_counters {
+    unsigned long long draw_calls;
+    unsigned long long texture_uploads;       /* line textures, atlas, cells */
+    unsigned long long texture_upload_bytes;
+    unsigned long long glyphs_rasterized;     /* rendered by FreeType */
+    unsigned long long lines_rebuilt;         /* rasterized or put in cells */
+    double render_ms;     /* in Console_Draw, layout included */
+    double layout_ms;     /* laying out lines to draw them */
+    double input_ms;      /* in the input function and generators */
+    double mutex_wait_ms; /* waiting for the console's lock */
+} Console_Counters;
+
+typedef struct _console_stats {
+    Console_Counters frame;   /* the last frame drawn */
+    Console_Counters total;   /* since the console was created */
+    unsigned long long frames;
+    int lines;                /* lines in the scrollback */
+    int pooled_textures;      /* spare line textures waiting to be reused */
+} Console_Stats;
+
+/*
+ * Keep cache files in `dir', which is created if needed. A font's metrics
+ * and rendered glyphs are saved there and mapped by later runs instead of
+ * being rendered again, as are the linked shader programs when the driver
+ * supports program binaries. Call this before Console_Create. Passing NULL
+ * stops using the cache, which is the default. Fonts keep the directory they
+ * were loaded with.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetCachePath (const char *dir);
+
 /*
  * Create the console. 
  * The console will load the font at `font_path'. The font path *must* be a
@@ -26,6 +91,278 @@ Console_Create (SDL_Window *window,
                 Console_InputFunction input_func,
                 void *input_func_data);
 
+/*
+ * Create a console without a window, drawn in software into a `width' by
+ * `height' frame, for tests and tools that can't open a GL context. It's
+ * always open and takes keyboard and text events like an opened console.
+ * Console_Draw draws the frame, which can then be read with Console_GetFrame
+ * or written out with Console_SaveFrame. Only the lines render mode is
+ * supported.
+ * Returns NULL on error.
+ */
+Console_tty*
+Console_CreateHeadless (int width,
+                        int height,
+                        const char *font_path,
+                        const int font_size,
+                        Console_InputFunction input_func,
+                        void *input_func_data);
+
+/*
+ * Resize the frame of a headless console, laying its lines out again. The
+ * frame drawn last keeps its size until Console_Draw draws the next one.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFrameSize (Console_tty *tty, int width, int height);
+
+/*
+ * The last frame a headless console drew, `width' * `height' RGBA pixels
+ * with the top row first, or NULL if it hasn't been drawn yet. The frame
+ * changes with the next Console_Draw.
+ */
+const unsigned char*
+Console_GetFrame (Console_tty *tty, int *width, int *height);
+
+/*
+ * Write the last frame of a headless console to `path' as a binary PPM.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SaveFrame (Console_tty *tty, const char *path);
+
+/*
+ * Keep at most `lines' lines of scrollback, the line being typed included.
+ * Default is 128 and the least is 2. Extra lines are dropped oldest first,
+ * which frees their textures, so the window's GL context has to be current.
+ * This and Console_SetLineLength can be called right after Console_Create
+ * to size the console from the start, or at any time later.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetScrollback (Console_tty *tty, int lines);
+
+/*
+ * Set how many bytes of input a line holds, including the terminating NUL.
+ * Default is 256 and the least is 5. Lines that are too long are cut.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetLineLength (Console_tty *tty, int chars);
+
+/*
+ * Running the same command again with the same output counts up the line
+ * before, shown as "(xN)", instead of adding a line. Default is off.
+ */
+void
+Console_SetCollapseRepeats (Console_tty *tty, int collapse);
+
+/*
+ * Keep one copy of each distinct output, shared by every line that printed
+ * it, so commands printing the same text over and over take memory for it
+ * once. Line textures aren't shared since they hold each line's prompt and
+ * input too. Default is off.
+ */
+void
+Console_SetInternOutput (Console_tty *tty, int intern);
+
+/*
+ * Show only the lines with `filter' in their input or output and highlight
+ * where it matches; NULL shows every line again. Ctrl+F does the same from
+ * the keyboard: type the filter, and Enter or Ctrl+F again to stop.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFilter (Console_tty *tty, const char *filter);
+
+/*
+ * Fill `usage' with the memory the console uses. The filter's line counts
+ * with the scrollback, and glyphs in mapped cache files or owned by FreeType
+ * don't count. GPU bytes are estimates from the sizes of the textures and
+ * buffers the console created. Traces, recordings, the session log and
+ * remote clients' buffers aren't counted.
+ */
+void
+Console_GetMemoryUsage (Console_tty *tty, Console_MemoryUsage *usage);
+
+/*
+ * Fill `stats' with what the console did in the last frame drawn and in
+ * total. Work done between frames, like running commands, counts towards
+ * the next frame. Counting is cheap; building with CONSOLE_NO_STATS defined
+ * removes it and the counters read as zero.
+ */
+void
+Console_GetStats (Console_tty *tty, Console_Stats *stats);
+
+/*
+ * Record trace events for the console's work: Console_Render, line texture
+ * updates, resizes, Console_NewLine, and calls to the input function and
+ * generators. The last `max_events' events are kept, 65536 if it's 0.
+ * Where GL has timer queries, the GPU time of each frame is recorded too.
+ * Recording never blocks, so it can stay on while profiling a game.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_StartTrace (Console_tty *tty, int max_events);
+
+/*
+ * Write the recorded events to `path' as Chrome trace JSON, which
+ * chrome://tracing and Perfetto open. Timestamps are SDL_GetPerformanceCounter
+ * in microseconds, so events the program traces with that clock line up.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_WriteTrace (Console_tty *tty, const char *path);
+
+/*
+ * Stop tracing and drop the recorded events. With GPU timing the window's GL
+ * context has to be current.
+ */
+void
+Console_StopTrace (Console_tty *tty);
+
+/*
+ * Record how long the last frame took in milliseconds. Without this the
+ * console times frames from one Console_Draw to the next. The `perf' command
+ * and the frame graph show the last of these.
+ */
+void
+Console_RecordFrameTime (Console_tty *tty, float ms);
+
+/*
+ * Show a graph of recent frame times in the top right of the console. It's
+ * drawn with the text, adding at most one draw call. `perf graph' toggles
+ * it too.
+ */
+void
+Console_SetFrameGraph (Console_tty *tty, int show);
+
+/*
+ * The console runs a few commands itself instead of passing them to the
+ * input function: `perf [frames]' prints the p50, p99 and max of the last
+ * frame times, `perf graph' toggles the frame graph, `perf reset' forgets
+ * the frame times and `exec <file>' runs a file like Console_ExecFile. They
+ * are off by default, leaving every command to the input function; pass 1 to
+ * turn them on.
+ */
+void
+Console_SetBuiltinCommands (Console_tty *tty, int enable);
+
+/*
+ * Record to `path' every event the console handles, with when it happened,
+ * what the input function and generators give back, and when frames are
+ * drawn, in a compact binary log.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_StartRecording (Console_tty *tty, const char *path);
+
+/*
+ * Finish the recording.
+ * Returns 1 if it couldn't be written, 0 otherwise.
+ */
+int
+Console_StopRecording (Console_tty *tty);
+
+/*
+ * Play back the recording at `path' against the console: events are handled,
+ * commands get the outputs they got when recorded instead of running the
+ * input function, and Console_Draw is called where frames were drawn,
+ * followed by `frame' if it isn't NULL, e.g. to swap the window. With
+ * `realtime' events keep their recorded timing, otherwise they're replayed
+ * as fast as possible. Headless consoles are sized as the recorded one was.
+ * Frame times end up in the `perf' command and Console_GetStats.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_Replay (Console_tty *tty, const char *path, int realtime,
+        Console_FrameFunction frame, void *frame_data);
+
+/*
+ * Mirror every command entered and everything printed to the file at
+ * `path', adding to what's there. The file is written by a thread of its own
+ * so the console never waits for the disk, and is flushed at least once a
+ * second. Once it's over `max_size' bytes it's renamed `path.1', `path.1'
+ * becomes `path.2' and so on up to `keep' files. If either is 0 the file is
+ * never rotated and just keeps growing.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_StartLog (Console_tty *tty, const char *path, size_t max_size,
+        int keep);
+
+/*
+ * Write out what's left of the log and close it.
+ */
+void
+Console_StopLog (Console_tty *tty);
+
+/*
+ * Write the scrollback to `path', oldest line first, as an index of lines
+ * followed by their text. This doesn't allocate memory.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SaveSnapshot (Console_tty *tty, const char *path);
+
+/*
+ * Console_SaveSnapshot without taking the console's lock, for crash handlers
+ * that can't wait for a lock the crashed thread may hold. Nothing else may
+ * be changing the console while it runs, so stop other threads that use it
+ * first, the listener's included.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SaveSnapshotUnlocked (Console_tty *tty, const char *path);
+
+/*
+ * Put the lines of a snapshot above the console's lines, newest first, as
+ * many as the scrollback holds. The file is mapped and outputs are used from
+ * it in place; lines are only laid out and rasterized once they're drawn.
+ * A missing snapshot, as on a first run, leaves the console as it was and
+ * doesn't stop it being drawn.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_LoadSnapshot (Console_tty *tty, const char *path);
+
+/*
+ * Run every line of the file at `path' as a command, as if typed and entered,
+ * skipping blank lines and lines starting with `#'. Lines are only laid out
+ * and rasterized once they're drawn, so long files such as configs load at
+ * the speed of the input function. Files only run other files with `exec'
+ * when built-in commands are on, see Console_SetBuiltinCommands. Called from
+ * the input function, the file runs once the command calling it is done,
+ * like with `exec'. Generators can't run files.
+ * Returns 1 if the file can't be read or a command failed, 0 otherwise.
+ */
+int
+Console_ExecFile (Console_tty *tty, const char *path);
+
+/*
+ * Listen for commands on the Unix domain socket at `path', replacing a
+ * socket left there. Every line a client sends is run as if it was typed and
+ * entered, and what the command printed is sent back followed by a NUL byte.
+ * Clients may send any number of commands without waiting for their output.
+ * Built-in commands run for clients too when they're on, and `exec' reads
+ * any file the program can, so leave them off if others can reach `path'.
+ * A generator's output is pulled as the client reads it, and the client's
+ * next command runs once the generator is done. With `threaded' clients are
+ * served by a thread of the console's own, otherwise they're served in
+ * Console_Draw, even while the console is closed. Commands still run in
+ * Console_Draw unless the console is headless, since they may rasterize
+ * lines.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_Listen (Console_tty *tty, const char *path, int threaded);
+
+/*
+ * Stop listening, disconnecting every client and removing the socket.
+ */
+void
+Console_StopListening (Console_tty *tty);
+
 /*
  * In the `input_func`, this function handles memory for output and should
  * be used instead of malloc, realloc, etc.
@@ -33,6 +370,38 @@ Console_Create (SDL_Window *window,
 void
 Console_SetOutput (char **out, const char *s);
 
+/*
+ * In the `input_func`, show `len' bytes of `text' as the output in place
+ * instead of copying it. The text doesn't need to be NUL-terminated and has
+ * to stay valid until `release' is called with `text' and `release_data'.
+ * `release' may be NULL for text that lives as long as the console. Outside
+ * a call from the console, e.g. an input function called by a test, `*out'
+ * gets a copy of the text like Console_SetOutput and `release' is called at
+ * once.
+ */
+void
+Console_SetOutputView (char **out,
+                       const char *text,
+                       size_t len,
+                       Console_ReleaseFunction release,
+                       void *release_data);
+
+/*
+ * In the `input_func`, have the output pulled a line at a time from `next',
+ * only as it's needed to fill the window or as the view is scrolled down
+ * with Page Down. `next' is given `state' and an output to set like the
+ * input function's, and returns 1 while it has lines and 0 once it's done.
+ * `finish' is called with `state' when the generator is done or is dropped
+ * for the next command, and may be NULL. Outside a call from the console
+ * there's nothing to pull the lines, so `finish' is called at once and
+ * `*out' is left alone.
+ */
+void
+Console_SetOutputGenerator (char **out,
+                            Console_GeneratorFunction next,
+                            Console_FinishFunction finish,
+                            void *state);
+
 /*
  * Set the background color of the console.
  * Default is 0.0f, 0.0f, 0.0f, 0.90f.
@@ -47,9 +416,76 @@ Console_SetBackgroundColor (Console_tty *tty, Console_Color);
 void
 Console_SetFontColor (Console_tty *tty, Console_Color);
 
+/*
+ * Change the font and its size. Fonts that have been used before are switched
+ * to on the next frame. New fonts are loaded in the background and the
+ * current font is shown until they are ready. Ctrl +/- and Ctrl 0 also zoom
+ * while the console is open.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFont (Console_tty *tty, const char *font_path, int font_size);
+
+/*
+ * Change the size of the current font, see Console_SetFont.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetFontSize (Console_tty *tty, int font_size);
+
+/*
+ * Get the size of the font asked for last, which may still be loading.
+ */
+int
+Console_GetFontSize (Console_tty *tty);
+
+/*
+ * Switch how the console is rendered. Default is CONSOLE_RENDER_LINES.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_SetRenderMode (Console_tty *tty, Console_RenderMode mode);
+
+/*
+ * Have the console save the GL state it changes while drawing and restore it
+ * afterwards. Only the state the console actually touches is queried, and
+ * only once, since the console remembers it from frame to frame.
+ * Default is off: the console resets what it changed to GL's defaults.
+ */
+void
+Console_SetRestoreGLState (Console_tty *tty, int restore);
+
+/*
+ * The console remembers the GL state it leaves behind so it doesn't set or
+ * query it again every frame. Call this after changing the program, vertex
+ * array, array buffer, active texture, 2D or buffer texture binding, unpack
+ * alignment, blending, blend func or face culling between console draws, or
+ * after making a new GL context current.
+ */
+void
+Console_InvalidateGLState (Console_tty *tty);
+
+/*
+ * Limit the GPU memory the console uses to about `bytes', 0 for no limit
+ * (the default). Past the limit, textures of lines scrolled off screen are
+ * dropped and drawn again when the lines come back into view.
+ */
+void
+Console_SetGPUBudget (Console_tty *tty, size_t bytes);
+
+/*
+ * The console's GL resources are created the first time it's drawn. Call
+ * this to create them earlier, e.g. during a loading screen. The window's GL
+ * context has to be current.
+ * Returns 1 on error, 0 otherwise.
+ */
+int
+Console_WarmUp (Console_tty *tty);
+
 /*
  * Handle drawing the console if it is toggled.
- * Returns 1 on an error, 0 otherwise.
+ * Returns 1 on an error, 0 otherwise. Errors from the event watches, which
+ * have no way to return them, make every later call fail too.
  */
 int
 Console_Draw (Console_tty *tty);
@@ -0,0 +1,379 @@
+/*
+ * Benchmarks for the console's hot paths. The library is built into this
+ * file so internal functions can be timed directly.
+ *
+ * Usage: bench <monospaced font path> <font size> [csv] [headless]
+ *
+ * Results are printed as JSON, or CSV with `csv'. With `headless', or when no
+ * GL window can be made, the console is drawn in software and the line
+ * texture benchmarks are skipped.
+ */
+#include "SDL_console.c"
+
+#define BENCH_MAX_RESULTS 32
+
+typedef struct _Bench_Result {
+    const char *name;
+    int param;             /* e.g. the scrollback depth, 0 if none */
+    long iterations;
+    double ns_per_op;
+    double bytes_per_op;   /* for throughput, 0 if it doesn't apply */
+} Bench_Result;
+
+static Bench_Result results[BENCH_MAX_RESULTS];
+static int num_results;
+static bool gl;
+
+/* Number of `log' lines output so far, so no two collapse into one */
+static long log_count;
+
+static const char *short_output =
+    "Short output that you'd expect on the console.";
+static const char *long_output =
+    "Really long output! Lorem ipsum dolor sit amet, consectetur adipiscing "
+    "elit. Sed tincidunt, odio quis pulvinar suscipit, dolor nibh lobortis "
+    "massa, quis sollicitudin ipsum sapien nec leo. Donec id sem sapien. "
+    "Quisque dignissim eget sem ac bibendum. Suspendisse aliquam est finibus "
+    "tellus molestie faucibus. Vestibulum volutpat feugiat nulla ut pharetra. "
+    "Etiam facilisis, nunc in ullamcorper tempus, velit ante molestie turpis, "
+    "at aliquet orci odio in arcu. Aenean dignissim dolor libero, et rhoncus "
+    "felis elementum hendrerit.";
+
+int
+bench_input (const char *text, void *data, char **output)
+{
+    char line[128];
+
+    if (strcmp(text, "short") == 0)
+        Console_SetOutput(output, short_output);
+    else if (strcmp(text, "long") == 0)
+        Console_SetOutput(output, long_output);
+    else if (strcmp(text, "log") == 0) {
+        snprintf(line, sizeof(line), "[%08ld] \033[32mINFO\033[0m "
+                "worker: request handled in %ld us", log_count,
+                log_count % 997);
+        log_count++;
+        Console_SetOutput(output, line);
+    }
+    return 0;
+}
+
+Uint64
+bench_now (void)
+{
+    return SDL_GetPerformanceCounter();
+}
+
+double
+bench_ns (Uint64 start)
+{
+    return (double)(bench_now() - start) * 1e9 /
+        SDL_GetPerformanceFrequency();
+}
+
+void
+bench_add (const char *name, int param, long iterations, double ns,
+        double bytes_per_op)
+{
+    Bench_Result *r;
+
+    if (num_results == BENCH_MAX_RESULTS || iterations == 0)
+        return;
+    r = &results[num_results++];
+    r->name = name;
+    r->param = param;
+    r->iterations = iterations;
+    r->ns_per_op = ns / iterations;
+    r->bytes_per_op = bytes_per_op;
+}
+
+/* Make sure the GPU's work is part of what's timed */
+void
+bench_finish (void)
+{
+    if (gl)
+        glFinish();
+}
+
+/*
+ * Run `command' as if typed and entered.
+ */
+int
+bench_command (Console_tty *tty, const char *command)
+{
+    _Console_get_input(tty, command);
+    return Console_NewLine(tty, bench_input, NULL);
+}
+
+/*
+ * Fill the scrollback with `n' commands, every fourth with long output.
+ */
+int
+bench_fill (Console_tty *tty, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (bench_command(tty, i % 4 == 3 ? "long" : "short"))
+            return 1;
+    return 0;
+}
+
+/*
+ * Typing and deleting characters of the line being typed.
+ */
+void
+bench_typing (Console_tty *tty)
+{
+    double ns_insert = 0.0, ns_remove = 0.0;
+    long n = 0;
+    int round, i, len = tty->max_input - 1;
+    Uint64 start;
+
+    for (round = 0; round < 4000; round++) {
+        start = bench_now();
+        for (i = 0; i < len; i++)
+            _Console_get_input(tty, "a");
+        ns_insert += bench_ns(start);
+
+        start = bench_now();
+        for (i = 0; i < len; i++)
+            _Console_remove_input(tty);
+        ns_remove += bench_ns(start);
+        n += len;
+    }
+    bench_add("type_char", 0, n, ns_insert, 0.0);
+    bench_add("delete_char", 0, n, ns_remove, 0.0);
+}
+
+/*
+ * Laying out a line and, with GL, rasterizing it to its texture.
+ */
+int
+bench_line (Console_tty *tty, const char *command, const char *layout_name,
+        const char *texture_name)
+{
+    Console_Line *line;
+    Uint64 start;
+    int i, n = 2000;
+
+    if (bench_command(tty, command))
+        return 1;
+    line = tty->lines_head->next;
+
+    start = bench_now();
+    for (i = 0; i < n * 10; i++)
+        _Console_line_rows(tty, line);
+    bench_add(layout_name, 0, n * 10, bench_ns(start), 0.0);
+
+    if (!gl)
+        return 0;
+    start = bench_now();
+    for (i = 0; i < n; i++)
+        if (_Console_update_line_texture(tty, line, line))
+            return 1;
+    bench_finish();
+    bench_add(texture_name, 0, n, bench_ns(start), 0.0);
+    return 0;
+}
+
+/*
+ * Changing the window's size with a full scrollback, including drawing the
+ * frame after which lays out and rasterizes the lines again.
+ */
+int
+bench_resize (Console_tty *tty, SDL_Window *window)
+{
+    Uint64 start;
+    int i, n = 200;
+    int w = tty->window_width, h = tty->window_height;
+
+    if (Console_SetScrollback(tty, 128) || bench_fill(tty, 128))
+        return 1;
+    start = bench_now();
+    for (i = 0; i < n; i++) {
+        int width = i % 2 ? w : w - 64;
+        if (window) {
+            SDL_SetWindowSize(window, width, h);
+            _Console_set_window_size(tty);
+        } else if (Console_SetFrameSize(tty, width, h)) {
+            return 1;
+        }
+        if (Console_Draw(tty))
+            return 1;
+    }
+    bench_finish();
+    bench_add("resize_reflow", 128, n, bench_ns(start), 0.0);
+    return 0;
+}
+
+/*
+ * Drawing frames with nothing changing at different scrollback depths.
+ */
+int
+bench_draw (Console_tty *tty)
+{
+    static const int depths[] = { 16, 128, 1024, 8192 };
+    Uint64 start;
+    int d, i, n = gl ? 500 : 50;
+
+    for (d = 0; d < (int)(sizeof(depths) / sizeof(*depths)); d++) {
+        if (Console_SetScrollback(tty, depths[d]) ||
+                bench_fill(tty, depths[d]))
+            return 1;
+        /* the first frame rasterizes what's visible */
+        if (Console_Draw(tty))
+            return 1;
+        bench_finish();
+
+        start = bench_now();
+        for (i = 0; i < n; i++)
+            if (Console_Draw(tty))
+                return 1;
+        bench_finish();
+        bench_add("draw_frame", depths[d], n, bench_ns(start), 0.0);
+    }
+    return 0;
+}
+
+/*
+ * Commands printing a log line each, drawing a frame every 100 lines like a
+ * program logging faster than it renders.
+ */
+int
+bench_ingest (Console_tty *tty)
+{
+    Uint64 start;
+    long i, n = 20000;
+    size_t bytes = 0;
+    Console_Line *line;
+
+    if (Console_SetScrollback(tty, 1024))
+        return 1;
+    start = bench_now();
+    for (i = 0; i < n; i++) {
+        if (bench_command(tty, "log"))
+            return 1;
+        line = tty->lines_head->next;
+        bytes += line->output_len;
+        if (i % 100 == 99 && Console_Draw(tty))
+            return 1;
+    }
+    bench_finish();
+    bench_add("log_ingest", 0, n, bench_ns(start), (double)bytes / n);
+    return 0;
+}
+
+void
+bench_print (bool csv)
+{
+    int i;
+    Bench_Result *r;
+
+    if (csv)
+        printf("name,param,iterations,ns_per_op,ops_per_sec,mb_per_sec\n");
+    else
+        printf("{\n  \"renderer\": \"%s\",\n  \"results\": [\n",
+                gl ? "gl" : "headless");
+
+    for (i = 0; i < num_results; i++) {
+        r = &results[i];
+        if (csv)
+            printf("%s,%d,%ld,%.1f,%.1f,%.2f\n", r->name, r->param,
+                    r->iterations, r->ns_per_op, 1e9 / r->ns_per_op,
+                    r->bytes_per_op * 1e3 / r->ns_per_op);
+        else
+            printf("    { \"name\": \"%s\", \"param\": %d, "
+                    "\"iterations\": %ld, \"ns_per_op\": %.1f, "
+                    "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f }%s\n",
+                    r->name, r->param, r->iterations, r->ns_per_op,
+                    1e9 / r->ns_per_op, r->bytes_per_op * 1e3 / r->ns_per_op,
+                    i + 1 < num_results ? "," : "");
+    }
+
+    if (!csv)
+        printf("  ]\n}\n");
+}
+
+int
+main (int argc, char **argv)
+{
+    SDL_Window   *window = NULL;
+    SDL_GLContext glContext = NULL;
+    Console_tty  *tty = NULL;
+    bool csv = false, headless = false;
+    int i, ret = 1;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <monospaced font path> <font size> "
+                "[csv] [headless]\n", argv[0]);
+        exit(1);
+    }
+    for (i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "csv") == 0)
+            csv = true;
+        else if (strcmp(argv[i], "headless") == 0)
+            headless = true;
+    }
+
+    if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "SDL Failed to init: %s\n", SDL_GetError());
+        exit(1);
+    }
+
+    if (!headless) {
+        window = SDL_CreateWindow("Console benchmark",
+            SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+            640, 480, SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL);
+        if (window)
+            glContext = SDL_GL_CreateContext(window);
+        if (!glContext) {
+            fprintf(stderr, "Warning: no GL context, running headless: %s\n",
+                    SDL_GetError());
+            if (window)
+                SDL_DestroyWindow(window);
+            window = NULL;
+        }
+    }
+    gl = glContext != NULL;
+
+    if (gl)
+        tty = Console_Create(window, argv[1], atoi(argv[2]), SDLK_UNKNOWN,
+                bench_input, NULL);
+    else
+        tty = Console_CreateHeadless(640, 480, argv[1], atoi(argv[2]),
+                bench_input, NULL);
+    if (!tty) {
+        fprintf(stderr, "Console could not init: %s\n", Console_GetError());
+        goto quit;
+    }
+    /* the console is drawn as if opened */
+    tty->status = true;
+    if (gl && Console_WarmUp(tty))
+        goto error;
+    Console_SetCollapseRepeats(tty, 0);
+
+    bench_typing(tty);
+    if (bench_line(tty, "short", "layout_short", "rebuild_short") ||
+            bench_line(tty, "long", "layout_long", "rebuild_long") ||
+            bench_resize(tty, window) ||
+            bench_draw(tty) ||
+            bench_ingest(tty))
+        goto error;
+
+    bench_print(csv);
+    ret = 0;
+    goto quit;
+
+error:
+    fprintf(stderr, "%s\n", Console_GetError());
+quit:
+    if (tty)
+        Console_Destroy(tty);
+    if (glContext)
+        SDL_GL_DeleteContext(glContext);
+    if (window)
+        SDL_DestroyWindow(window);
+    SDL_Quit();
+    return ret;
+}